@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+#include "built-in.h"
+#include "launch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+// Placement policies for commands started by ksh_launch:
+// (1) none         inherit the shell's affinity (default)
+// (2) round-robin  pin each command to the least busy single CPU
+// (3) node-local   pin each command to all CPUs of the least busy NUMA node
+//                  and prefer memory from that node
+// (4) explicit     pin every command to a fixed CPU list
+// The parent picks the placement before fork, and the child applies it
+// between fork and execvp, so the new program never runs anywhere else.
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+enum ksh_affinity_policy { AFFINITY_NONE, AFFINITY_ROUND_ROBIN, AFFINITY_NODE_LOCAL, AFFINITY_EXPLICIT };
+
+static enum ksh_affinity_policy policy = AFFINITY_NONE;
+static uint64_t explicit_cpus[KSH_MAX_CPUS / 64];
+
+// One-shot placement set by the 'pin' prefix for the next launch
+static struct ksh_placement pinned;
+
+// Machine topology, read once from sysfs
+static int topology_loaded;
+static uint64_t allowed_cpus[KSH_MAX_CPUS / 64];     // CPUs the shell itself may use
+static uint64_t node_cpus[KSH_MAX_NODES][KSH_MAX_CPUS / 64];
+static int num_nodes;
+
+// Live commands and how many of them sit on each CPU / node
+struct ksh_job_placement {
+    pid_t pid;
+    struct ksh_placement pl;
+};
+static struct ksh_job_placement* jobs;
+static int num_jobs, jobs_cap;
+static int cpu_load[KSH_MAX_CPUS];
+static int node_load[KSH_MAX_NODES];
+static int cursor;      // rotates the tie-break so equal loads still spread out
+
+#define BIT_SET(map, i) ((map)[(i) / 64] |= 1ull << ((i) % 64))
+#define BIT_TEST(map, i) (((map)[(i) / 64] >> ((i) % 64)) & 1)
+
+// Parse a CPU list like "0-3,8,10-11" into a bitmap, returns -1 if malformed
+static int parse_cpu_list(const char* s, uint64_t map[KSH_MAX_CPUS / 64])
+{
+    memset(map, 0, sizeof(uint64_t) * (KSH_MAX_CPUS / 64));
+    while (*s && *s != '\n')
+    {
+        char* end;
+        long lo = strtol(s, &end, 10), hi = lo;
+        if (end == s) return -1;
+        if (*end == '-')
+        {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s) return -1;
+        }
+        if (lo < 0 || hi < lo || hi >= KSH_MAX_CPUS) return -1;
+        for (long c = lo; c <= hi; c ++ ) BIT_SET(map, c);
+        s = end;
+        if (*s == ',') s ++ ;
+        else if (*s && *s != '\n') return -1;
+    }
+    return 0;
+}
+
+static void load_topology(void)
+{
+    if (topology_loaded) return;
+    topology_loaded = 1;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int c = 0; c < KSH_MAX_CPUS && c < CPU_SETSIZE; c ++ )
+            if (CPU_ISSET(c, &set)) BIT_SET(allowed_cpus, c);
+    }
+    else for (int c = 0; c < KSH_MAX_CPUS && c < sysconf(_SC_NPROCESSORS_ONLN); c ++ ) BIT_SET(allowed_cpus, c);
+
+    // /sys/devices/system/node/nodeN/cpulist lists the CPUs of every NUMA node
+    for (int n = 0; n < KSH_MAX_NODES; n ++ )
+    {
+        char path[64], line[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+        FILE* f = fopen(path, "r");
+        if (f == NULL) continue;
+        if (fgets(line, sizeof(line), f) && parse_cpu_list(line, node_cpus[n]) == 0 && n + 1 > num_nodes) num_nodes = n + 1;
+        fclose(f);
+    }
+
+    // Without NUMA information treat the machine as one node
+    if (num_nodes == 0)
+    {
+        memcpy(node_cpus[0], allowed_cpus, sizeof(allowed_cpus));
+        num_nodes = 1;
+    }
+}
+
+int ksh_affinity_set_policy(const char* spec)
+{
+    if (strcmp(spec, "none") == 0) policy = AFFINITY_NONE;
+    else if (strcmp(spec, "round-robin") == 0) policy = AFFINITY_ROUND_ROBIN;
+    else if (strcmp(spec, "node-local") == 0) policy = AFFINITY_NODE_LOCAL;
+    else if (strncmp(spec, "explicit:", 9) == 0 && parse_cpu_list(spec + 9, explicit_cpus) == 0) policy = AFFINITY_EXPLICIT;
+    else return -1;
+    return 0;
+}
+
+const char* ksh_affinity_policy_name(void)
+{
+    static const char* names[] = { "none", "round-robin", "node-local", "explicit" };
+    return names[policy];
+}
+
+// Choose the placement for the command about to be launched
+void ksh_affinity_place(struct ksh_placement* pl)
+{
+    if (pinned.active)
+    {
+        *pl = pinned;
+        pinned.active = 0;
+        return;
+    }
+
+    memset(pl, 0, sizeof(*pl));
+    pl->node = -1;
+    if (policy == AFFINITY_NONE) return;
+    load_topology();
+    pl->active = 1;
+
+    if (policy == AFFINITY_EXPLICIT) memcpy(pl->cpus, explicit_cpus, sizeof(explicit_cpus));
+    else if (policy == AFFINITY_ROUND_ROBIN)
+    {
+        // least loaded allowed CPU, starting the search after the last pick
+        int best = -1;
+        for (int k = 0; k < KSH_MAX_CPUS; k ++ )
+        {
+            int c = (cursor + k) % KSH_MAX_CPUS;
+            if (BIT_TEST(allowed_cpus, c) && (best < 0 || cpu_load[c] < cpu_load[best])) best = c;
+        }
+        if (best < 0) { pl->active = 0; return; }
+        BIT_SET(pl->cpus, best);
+        cursor = best + 1;
+    }
+    else
+    {
+        // least loaded node that has at least one CPU we may use
+        int best = -1;
+        for (int k = 0; k < num_nodes; k ++ )
+        {
+            int n = (cursor + k) % num_nodes;
+            int usable = 0;
+            for (int w = 0; w < KSH_MAX_CPUS / 64; w ++ ) usable |= (node_cpus[n][w] & allowed_cpus[w]) != 0;
+            if (usable && (best < 0 || node_load[n] < node_load[best])) best = n;
+        }
+        if (best < 0) { pl->active = 0; return; }
+        for (int w = 0; w < KSH_MAX_CPUS / 64; w ++ ) pl->cpus[w] = node_cpus[best][w] & allowed_cpus[w];
+        pl->node = best;
+        cursor = best + 1;
+    }
+}
+
+// Runs in the child between fork and execvp
+void ksh_affinity_apply(const struct ksh_placement* pl)
+{
+    if (!pl->active) return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c = 0; c < KSH_MAX_CPUS && c < CPU_SETSIZE; c ++ )
+        if (BIT_TEST(pl->cpus, c)) CPU_SET(c, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) perror("ksh: sched_setaffinity failed...");
+
+    if (pl->node >= 0)
+    {
+        // Preferred rather than bound: allocations spill to other nodes instead of failing
+        unsigned long nodemask[KSH_MAX_NODES / (8 * sizeof(unsigned long)) + 1] = { 0 };
+        nodemask[pl->node / (8 * sizeof(unsigned long))] |= 1ul << (pl->node % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodemask, KSH_MAX_NODES + 1) != 0)
+            perror("ksh: set_mempolicy failed...");
+    }
+}
+
+// Count a running command against the CPUs and node it was given
+static void adjust_load(const struct ksh_placement* pl, int delta)
+{
+    for (int c = 0; c < KSH_MAX_CPUS; c ++ ) if (BIT_TEST(pl->cpus, c)) cpu_load[c] += delta;
+    if (pl->node >= 0) node_load[pl->node] += delta;
+}
+
+void ksh_affinity_track(pid_t pid, const struct ksh_placement* pl)
+{
+    if (!pl->active) return;
+    if (num_jobs == jobs_cap)
+    {
+        jobs_cap = jobs_cap ? jobs_cap * 2 : 16;
+        jobs = realloc(jobs, sizeof(struct ksh_job_placement) * jobs_cap);
+        if (!jobs) ksh_allocate_error();
+    }
+    jobs[num_jobs].pid = pid;
+    jobs[num_jobs ++ ].pl = *pl;
+    adjust_load(pl, 1);
+}
+
+void ksh_affinity_release(pid_t pid)
+{
+    for (int j = 0; j < num_jobs; j ++ )
+        if (jobs[j].pid == pid)
+        {
+            adjust_load(&jobs[j].pl, -1);
+            jobs[j] = jobs[ -- num_jobs];
+            return;
+        }
+}
+
+// pin command: pin <cpu-list> | -n <node>  command [args...]
+// Runs one command with the given placement, overriding the shell-wide policy.
+// Built-ins run inside the shell itself and are not moved.
+int ksh_pin(char** args)
+{
+    int cmd = 2;
+    memset(&pinned, 0, sizeof(pinned));
+    pinned.node = -1;
+
+    if (args[1] != NULL && strcmp(args[1], "-n") == 0 && args[2] != NULL)
+    {
+        load_topology();
+        char* end;
+        long n = strtol(args[2], &end, 10);
+        if (*end != '\0' || n < 0 || n >= num_nodes)
+        {
+            fprintf(stderr, "ksh: pin: no such NUMA node \'%s\'\n", args[2]);
+            ksh_last_status = 1;
+            return 1;
+        }
+        memcpy(pinned.cpus, node_cpus[n], sizeof(pinned.cpus));
+        pinned.node = (int) n;
+        cmd = 3;
+    }
+    else if (args[1] == NULL || parse_cpu_list(args[1], pinned.cpus) != 0)
+    {
+        fprintf(stderr, "Usage: pin <cpu-list> | -n <node>  command [args...]\n");
+        ksh_last_status = 2;
+        return 1;
+    }
+
+    if (args[cmd] == NULL)
+    {
+        fprintf(stderr, "ksh: pin: missing command\n");
+        ksh_last_status = 2;
+        return 1;
+    }
+    pinned.active = 1;
+    int status = ksh_execute(&args[cmd]);
+    pinned.active = 0;      // a built-in never consumed it
+    return status;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define KSH_MAX_CPUS 1024
+#define KSH_MAX_NODES 64
+
+// Where a launched command should run
+struct ksh_placement {
+    int active;                             // 0: inherit the shell's affinity
+    uint64_t cpus[KSH_MAX_CPUS / 64];       // CPU bitmap for sched_setaffinity
+    int node;                               // preferred NUMA node, or -1
+};
+
+// Function declarations for CPU and NUMA placement of launched commands
+extern int ksh_affinity_set_policy(const char* spec);
+extern const char* ksh_affinity_policy_name(void);
+extern void ksh_affinity_place(struct ksh_placement* pl);
+extern void ksh_affinity_apply(const struct ksh_placement* pl);
+extern void ksh_affinity_track(pid_t pid, const struct ksh_placement* pl);
+extern void ksh_affinity_release(pid_t pid);
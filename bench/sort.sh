@@ -0,0 +1,42 @@
+#!/bin/sh
+# Compare the ksh 'sort' built-in with GNU sort and report MB/s
+#
+# Usage: bench/sort.sh [size in MB] [sort options]
+# Run from the repository root after 'make'. Both sides get the same memory
+# cap (KSH_SORT_MEMORY, default 256M) and temp directory, so inputs larger
+# than the cap measure the spill and merge path.
+
+SIZE_MB=${1:-1024}
+OPTS=${2:-}
+MEM=${KSH_SORT_MEMORY:-256M}
+TMP=${TMPDIR:-/tmp}
+FILE=$TMP/ksh_sort_bench_$SIZE_MB.txt
+
+# Log-like lines: a word, a number and a random tail, with few shared prefixes
+if [ ! -f "$FILE" ] || [ "$(stat -c %s "$FILE")" -ne $((SIZE_MB * 1024 * 1024)) ]; then
+    awk 'BEGIN { srand(42); while (1) printf "host%03d %d %08x%08x\n", int(rand() * 500), int(rand() * 1000000), int(rand() * 4294967295), int(rand() * 4294967295) }' \
+        | head -c $((SIZE_MB * 1024 * 1024)) > "$FILE"
+fi
+
+# Warm the page cache so both sides start from the same place
+cat "$FILE" > /dev/null
+
+now() { date +%s.%N; }
+
+# Run the built-in from a script, so no prompt ends up in the output
+printf 'sort -S %s -T %s %s %s\n' "$MEM" "$TMP" "$OPTS" "$FILE" > "$TMP/ksh_sort_bench.script"
+t0=$(now)
+./shell "$TMP/ksh_sort_bench.script" > "$TMP/ksh_sort_bench.ksh"
+t1=$(now)
+LC_ALL=C sort -S "$MEM" -T "$TMP" $OPTS "$FILE" > "$TMP/ksh_sort_bench.gnu"
+t2=$(now)
+
+if cmp -s "$TMP/ksh_sort_bench.ksh" "$TMP/ksh_sort_bench.gnu"; then SAME=yes; else SAME=NO; fi
+rm -f "$TMP/ksh_sort_bench.script" "$TMP/ksh_sort_bench.ksh" "$TMP/ksh_sort_bench.gnu"
+
+awk -v mb="$SIZE_MB" -v a="$t0" -v b="$t1" -v c="$t2" -v opts="$OPTS" -v mem="$MEM" -v same="$SAME" 'BEGIN {
+    printf "sort %s on %d MB, memory cap %s\n", opts, mb, mem
+    printf "  ksh sort: %8.3f s  %7.1f MB/s\n", b - a, mb / (b - a)
+    printf "  GNU sort: %8.3f s  %7.1f MB/s\n", c - b, mb / (c - b)
+    printf "  same output: %s\n", same
+}'
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Compare the ksh 'wc' built-in with /usr/bin/wc and report GB/s
+#
+# Usage: bench/wc.sh [size in MB] [wc options]
+# Run from the repository root after 'make'.
+
+SIZE_MB=${1:-1024}
+OPTS=${2:--l}
+FILE=${TMPDIR:-/tmp}/ksh_wc_bench.txt
+
+# Text with short lines, so newline and word counting both have work to do
+if [ ! -f "$FILE" ] || [ "$(stat -c %s "$FILE")" -ne $((SIZE_MB * 1024 * 1024)) ]; then
+    yes "the quick brown fox jumps over the lazy dog 0123456789" | head -c $((SIZE_MB * 1024 * 1024)) > "$FILE"
+fi
+
+# Warm the page cache so both sides measure counting, not the disk
+cat "$FILE" > /dev/null
+
+now() { date +%s.%N; }
+
+t0=$(now)
+printf 'wc %s %s\nexit\n' "$OPTS" "$FILE" | ./shell > /dev/null
+t1=$(now)
+LC_ALL=C /usr/bin/wc $OPTS "$FILE" > /dev/null
+t2=$(now)
+
+awk -v mb="$SIZE_MB" -v a="$t0" -v b="$t1" -v c="$t2" -v opts="$OPTS" 'BEGIN {
+    gb = mb / 1024
+    printf "wc %s on %d MB\n", opts, mb
+    printf "  ksh wc:      %6.3f s  %6.2f GB/s\n", b - a, gb / (b - a)
+    printf "  /usr/bin/wc: %6.3f s  %6.2f GB/s\n", c - b, gb / (c - b)
+}'
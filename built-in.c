@@ -1,11 +1,17 @@
 #include "built-in.h"
+#include "launch.h"
+#include "affinity.h"
+#include "trash.h"
+#include "delta.h"
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <utime.h>
 #include <string.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <linux/limits.h>
@@ -27,6 +33,18 @@ char* builtin_str[] = {
     "rm",
     "touch",
     "chmod",
+    "cksum",
+    "sha256sum",
+    "find",
+    "wc",
+    "sort",
+    "tail",
+    "pin",
+    "set",
+    "memo",
+    "trace",
+    "source",
+    "trash",
     "help",
     "exit"
 };
@@ -44,6 +62,18 @@ int (*builtin_func[]) (char**) = {
     &ksh_rm,
     &ksh_touch,
     &ksh_chmod,
+    &ksh_cksum,
+    &ksh_cksum,
+    &ksh_find,
+    &ksh_wc,
+    &ksh_sort,
+    &ksh_tail,
+    &ksh_pin,
+    &ksh_set,
+    &ksh_memo,
+    &ksh_trace,
+    &ksh_source,
+    &ksh_trash,
     &ksh_help,
     &ksh_exit
 };
@@ -54,12 +84,16 @@ int ksh_num_builtins()
 }
 
 // Shell built-in commands
+// Each one leaves its exit status in ksh_last_status (0 for success) and
+// returns 1 to keep the shell running, only exit returns 0
 
 // 1. cd command
 int ksh_cd(char** args)
 {
+    ksh_last_status = 1;
     if (args[1] == NULL) fprintf(stderr, "ksh: expected arguments to \'cd\'...\n");
     else if (chdir(args[1]) != 0) perror("ksh: chdir failed..."); 
+    else ksh_last_status = 0;
     // Use chdir to change the current working directory
     // chdir receive a string as the path
     // if chdir success, return 0, else return -1
@@ -137,7 +171,8 @@ int ksh_ls(char** args)
     {
         if (strcmp(args[i], "-a") != 0 && strcmp(args[i], "-l") != 0 && i != 1) {
             fprintf(stderr, "ksh: unknown option \'%s\'...\n", args[i]);
-            exit(EXIT_FAILURE);
+            ksh_last_status = 1;
+            return 1;
         }
     }
     // Open the specified directory
@@ -173,8 +208,10 @@ int ksh_ls(char** args)
     else
     {
         perror("ksh: opendir failed...");
-        exit(EXIT_FAILURE);
+        ksh_last_status = 1;
+        return 1;
     }
+    ksh_last_status = 0;
     return 1;
 }
 
@@ -182,8 +219,13 @@ int ksh_ls(char** args)
 int ksh_pwd(char** args)
 {
     char cwd[PATH_MAX];
+    ksh_last_status = 0;
     if (getcwd(cwd, sizeof(cwd)) != NULL) printf("%s\n", cwd);
-    else perror("ksh: getcwd failed...");
+    else
+    {
+        perror("ksh: getcwd failed...");
+        ksh_last_status = 1;
+    }
     return 1;
 }
 
@@ -192,6 +234,7 @@ int ksh_echo(char** args)
 {
     for (int i = 1; args[i] != NULL; i++) printf("%s ", args[i]);
     printf("\n");
+    ksh_last_status = 0;
     return 1;
 }
 
@@ -201,7 +244,8 @@ int ksh_cat(char** args)
     if (args[1] == NULL) 
     {
         fprintf(stderr, "ksh: missing file argument\n");
-        exit(EXIT_FAILURE);
+        ksh_last_status = 1;
+        return 1;
     }
     
     // Open and read the file
@@ -211,23 +255,50 @@ int ksh_cat(char** args)
         if (file == NULL) 
         {
             perror("ksh: fopen failed...");
-            exit(EXIT_FAILURE);
+            ksh_last_status = 1;
+            return 1;
         }
 
         char c;
         while ((c = fgetc(file)) != EOF) putchar(c);
         fclose(file);
     }
+    ksh_last_status = 0;
     return 1;
 }
 
-// 6. cp command
+// 6. cp command with one option:
+// -u / --update rewrite only the parts of an existing destination that differ,
+//               and skip it entirely when size and mtime already match
 int ksh_cp(char** args)
 {
+    if (args[1] != NULL && (strcmp(args[1], "-u") == 0 || strcmp(args[1], "--update") == 0))
+    {
+        if (args[2] == NULL || args[3] == NULL)
+        {
+            fprintf(stderr, "ksh: missing source and destination arguments\n");
+            ksh_last_status = 1;
+            return 1;
+        }
+
+        struct ksh_delta_stats stats;
+        ksh_last_status = 0;
+        if (ksh_delta_copy(args[2], args[3], &stats) != 0)
+        {
+            perror("ksh: cp --update failed...");
+            ksh_last_status = 1;
+        }
+        else if (stats.skipped) printf("'%s' -> '%s': up to date, 0 bytes written\n", args[2], args[3]);
+        else printf("'%s' -> '%s': %llu of %llu bytes written (%d of %d chunks changed)\n", args[2], args[3],
+                    (unsigned long long) stats.written, (unsigned long long) stats.size, stats.changed, stats.chunks);
+        return 1;
+    }
+
     if (args[1] == NULL || args[2] == NULL) 
     {
         fprintf(stderr, "ksh: missing source and destination arguments\n");
-        exit(EXIT_FAILURE);
+        ksh_last_status = 1;
+        return 1;
     }
 
     // Open the source and destination files
@@ -235,14 +306,17 @@ int ksh_cp(char** args)
     if (src == NULL) 
     {
         perror("ksh: fopen failed...");
-        exit(EXIT_FAILURE);
+        ksh_last_status = 1;
+        return 1;
     }
 
     FILE* dest = fopen(args[2], "w");
     if (dest == NULL) 
     {
         perror("ksh: fopen failed...");
-        exit(EXIT_FAILURE);
+        fclose(src);
+        ksh_last_status = 1;
+        return 1;
     }
 
     // Copy the contents of the source file to the destination file
@@ -251,6 +325,7 @@ int ksh_cp(char** args)
     while ((c = fgetc(src)) != EOF) fputc(c, dest);
     fclose(src);
     fclose(dest);
+    ksh_last_status = 0;
     return 1;
 }
 
@@ -260,7 +335,8 @@ int ksh_mv(char** args)
     if (args[1] == NULL || args[2] == NULL) 
     {
         fprintf(stderr, "ksh: missing source and destination arguments\n");
-        exit(EXIT_FAILURE);
+        ksh_last_status = 1;
+        return 1;
     }
 
     // Rename the source file to the destination file
@@ -268,8 +344,10 @@ int ksh_mv(char** args)
     if (rename(args[1], args[2]) != 0) 
     {
         perror("ksh: rename failed...");
-        exit(EXIT_FAILURE);
+        ksh_last_status = 1;
+        return 1;
     }
+    ksh_last_status = 0;
     return 1;
 }
 
@@ -279,25 +357,83 @@ int ksh_mkdir(char** args)
     if (args[1] == NULL) 
     {
         fprintf(stderr, "ksh: missing directory argument\n");
-        exit(EXIT_FAILURE);
+        ksh_last_status = 1;
+        return 1;
     }
 
     // Create a new directory with the specified name with default permissions
     if (mkdir(args[1], 0777) != 0) 
     {
         perror("ksh: mkdir failed...");
-        exit(EXIT_FAILURE);
+        ksh_last_status = 1;
+        return 1;
     }
+    ksh_last_status = 0;
     return 1;
 }
 
+// Create 'path' and every missing parent directory, like "mkdir -p"
+int ksh_mkdirs(char* path)
+{
+    for (char* p = path + 1; *p; p ++ )
+        if (*p == '/')
+        {
+            *p = '\0';
+            // temporarily cut the path after this component
+            int r = mkdir(path, 0700);
+            *p = '/';
+            if (r != 0 && errno != EEXIST) return -1;
+        }
+    return (mkdir(path, 0700) != 0 && errno != EEXIST) ? -1 : 0;
+}
+
+// snprintf for a path in a PATH_MAX buffer: a path that does not fit fails
+// with ENAMETOOLONG, since cut short it would name some other file
+int ksh_path(char path[PATH_MAX], const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(path, PATH_MAX, fmt, ap);
+    va_end(ap);
+    if (n >= 0 && n < PATH_MAX) return 0;
+    errno = ENAMETOOLONG;
+    return -1;
+}
+
+// Directory for data the shell caches between runs, created if missing:
+// $<env> if set, else $XDG_CACHE_HOME/ksh/<sub>, else ~/.cache/ksh/<sub>,
+// else /tmp/ksh-<sub>-<uid>. What is cached there is trusted on the next
+// run, so a directory someone else created first (easy in /tmp) is refused.
+int ksh_cache_dir(const char* env, const char* sub, char dir[PATH_MAX])
+{
+    const char* override = getenv(env);
+    const char* cache = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    int r;
+    if (override) r = ksh_path(dir, "%s", override);
+    else if (cache) r = ksh_path(dir, "%s/ksh/%s", cache, sub);
+    else if (home) r = ksh_path(dir, "%s/.cache/ksh/%s", home, sub);
+    else r = ksh_path(dir, "/tmp/ksh-%s-%d", sub, (int) getuid());
+    if (r != 0 || ksh_mkdirs(dir) != 0) return -1;
+
+    struct stat st;
+    if (lstat(dir, &st) != 0) return -1;
+    if (!S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 0777) != 0700)
+    {
+        errno = EACCES;
+        return -1;
+    }
+    return 0;
+}
+
 // 9. rmdir command
 int ksh_rmdir(char** args)
 {
     if (args[1] == NULL) 
     {
         fprintf(stderr, "ksh: expected argument to \"rmdir\"\n");
-        exit(EXIT_FAILURE);
+        ksh_last_status = 1;
+        return 1;
     }
 
     // Use rmdir to remove the specified directory
@@ -306,17 +442,21 @@ int ksh_rmdir(char** args)
     if (rmdir(args[1]) != 0) 
     {
         perror("ksh: rmdir failed...");
-        exit(EXIT_FAILURE);
+        ksh_last_status = 1;
+        return 1;
     }
 
+    ksh_last_status = 0;
     return 1;
 }
 
-// 10. rm command with four options: 
+// 10. rm command with five options: 
 // (1) -r remove directories and their contents recursively,
 // (2) -f remove files without prompting, which means remove files forcefully,
 // (3) -v remove files verbosely, which means print the name of each file before removing it,
-// (4) -i remove files interactively, which means prompt before every removal.
+// (4) -i remove files interactively, which means prompt before every removal,
+// (5) --defer move the files into the trash and return at once, a background process deletes them
+//     (set -o rm=defer makes it the default).
 int remove_directory(const char* path, int force, int verbose, int interactive)
 {
     DIR* d = opendir(path);
@@ -436,6 +576,9 @@ int ksh_rm(char** args)
     int force = 0;
     int verbose = 0;
     int interactive = 0;
+    int defer = ksh_trash_defer;
+    int deferred = 0;       // number of files moved into the trash
+    int status = 0;         // 1 once any operand could not be removed
     int i = 1;              
     // Start from the first argument
 
@@ -446,10 +589,12 @@ int ksh_rm(char** args)
         else if (strcmp(args[i], "-f") == 0 || strcmp(args[i], "--force") == 0) force = 1;
         else if (strcmp(args[i], "-v") == 0 || strcmp(args[i], "--verbose") == 0) verbose = 1;
         else if (strcmp(args[i], "-i") == 0 || strcmp(args[i], "--interactive") == 0) interactive = 1;
+        else if (strcmp(args[i], "--defer") == 0) defer = 1;
         else 
         {
             fprintf(stderr, "ksh: unknown option \'%s\'...\n", args[i]);
-            exit(EXIT_FAILURE);
+            ksh_last_status = 1;
+            return 1;
         }
         i ++ ;
     }
@@ -458,7 +603,8 @@ int ksh_rm(char** args)
     if (args[i] == NULL)
     {
         fprintf(stderr, "ksh: missing file or directory argument\n");
-        exit(EXIT_FAILURE);
+        ksh_last_status = 1;
+        return 1;
     }
 
     // Remove all the provided files and directories
@@ -473,9 +619,9 @@ int ksh_rm(char** args)
             if (!force)
             {
                 perror("ksh: stat failed...");
-                exit(EXIT_FAILURE);
+                status = 1;
             }
-            else continue;
+            continue;
         }
 
         // 1. If it's a directory
@@ -483,12 +629,18 @@ int ksh_rm(char** args)
         {
             if (recursive)
             {
-                if (remove_directory(args[i], force, verbose, interactive) != 0)
+                if (defer && !interactive && ksh_trash_move(args[i]) == 0)
+                {
+                    // The whole tree is in the trash now, the reclaimer deletes it
+                    if (verbose) printf("trashed directory '%s'\n", args[i]);
+                    deferred ++ ;
+                }
+                else if (remove_directory(args[i], force, verbose, interactive) != 0)
                 {
                     if (!force)
                     {
                         perror("ksh: remove_directory failed...");
-                        exit(EXIT_FAILURE);
+                        status = 1;
                     }
                 }
             }
@@ -496,7 +648,7 @@ int ksh_rm(char** args)
             // If the file is a dir, but recursive option is not set
             {
                 fprintf(stderr, "ksh: cannot remove \'%s\': Is a directory\n", args[i]);
-                exit(EXIT_FAILURE);
+                status = 1;
             }
         }
         // 2. If the file is a regular file
@@ -520,19 +672,26 @@ int ksh_rm(char** args)
                 }
             }
 
+            if (defer && ksh_trash_move(args[i]) == 0)
+            {
+                if (verbose) printf("trashed '%s'\n", args[i]);
+                deferred ++ ;
+            }
             // Use unlink to remove the file
-            if (unlink(args[i]) != 0)
+            else if (unlink(args[i]) != 0)
             {
                 if (!force)
                 {
                     perror("ksh: unlink failed...");
-                    exit(EXIT_FAILURE);
+                    status = 1;
                 }
             }
             else if (verbose) printf("removed '%s'\n", args[i]);
         }
     }
 
+    if (deferred > 0) ksh_trash_reclaim();
+    ksh_last_status = status;
     return 1;
 }
 
@@ -542,7 +701,8 @@ int ksh_touch(char** args)
     if (args[1] == NULL) 
     {
         fprintf(stderr, "Usage: touch <file>\n");
-        exit(EXIT_FAILURE);
+        ksh_last_status = 1;
+        return 1;
     }
 
     const char* filepath = args[1];
@@ -556,11 +716,13 @@ int ksh_touch(char** args)
         if (fd < 0) 
         {
             perror("touch failed...");
-            exit(EXIT_FAILURE);
+            ksh_last_status = 1;
+            return 1;
         }
         close(fd);
     }
 
+    ksh_last_status = 0;
     return 1;
 }
 
@@ -570,7 +732,8 @@ int ksh_chmod(char** args)
     if (args[1] == NULL || args[2] == NULL) 
     {
         fprintf(stderr, "Usage: chmod <mode> <file>\n");
-        exit(EXIT_FAILURE);
+        ksh_last_status = 1;
+        return 1;
     }
 
     // Convert mode from string to octal
@@ -578,16 +741,19 @@ int ksh_chmod(char** args)
     if (mode == 0 && args[1][0] != '0') 
     {
         fprintf(stderr, "Invalid mode: %s\n", args[1]);
-        exit(EXIT_FAILURE);
+        ksh_last_status = 1;
+        return 1;
     }
 
     // Change the file mode
     if (chmod(args[2], mode) != 0) 
     {
         perror("chmod failed...\n");
-        exit(EXIT_FAILURE);
+        ksh_last_status = 1;
+        return 1;
     }
 
+    ksh_last_status = 0;
     return 1;
 }
 
@@ -599,7 +765,7 @@ int ksh_help(char** args)
     if (getcwd(cwd, sizeof(cwd)) == NULL) perror("ksh: getcwd failed...\n");
     int num_builtins = ksh_num_builtins();
     int columns = 4;
-    int width = 15;
+    int width = 17;
 
     printf("******************************************************************************\n");
     printf("*                                                                            *\n");
@@ -614,7 +780,7 @@ int ksh_help(char** args)
 
     // Print top border of the table
     printf("        +");
-    for (int i = 0; i < columns; i++) printf("---------------+");
+    for (int i = 0; i < columns; i++) printf("-----------------+");
     printf("\n");
     
     // Print commands in table format
@@ -625,7 +791,7 @@ int ksh_help(char** args)
         if (i % columns == 0) 
         {
             printf("|\n        +");
-            for (int j = 0; j < columns; j++) printf("---------------+");
+            for (int j = 0; j < columns; j++) printf("-----------------+");
             printf("\n");
         }
     }
@@ -633,9 +799,9 @@ int ksh_help(char** args)
     // Print bottom border if the last row is not complete
     if (num_builtins % columns != 0) 
     {
-        for (int i = 0; i < columns - (num_builtins % columns); i++) printf("|               ");
+        for (int i = 0; i < columns - (num_builtins % columns); i++) printf("|                 ");
         printf("|\n        +");
-        for (int i = 0; i < columns; i++) printf("---------------+");
+        for (int i = 0; i < columns; i++) printf("-----------------+");
         printf("\n");
     }
 
@@ -655,11 +821,72 @@ int ksh_help(char** args)
     printf("*                                  Bye-bye                                   *\n");
     printf("******************************************************************************\n");
 
+    ksh_last_status = 0;
     return 1;
 }
 
 //  14. exit command
+// exit [n]   leave the shell with status n, or with the status of the last command
 int ksh_exit(char** args)
 {
+    if (args[1] != NULL)
+    {
+        char* end;
+        long n = strtol(args[1], &end, 10);
+        if (*end != '\0' || end == args[1])
+        {
+            fprintf(stderr, "ksh: exit: numeric argument required\n");
+            n = 2;
+        }
+        ksh_last_status = n & 0xff;
+        // like _exit(2), only the low 8 bits reach the parent
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+// 15. set command
+// set -o                  show the shell options
+// set -o <name>=<value>   change one, e.g. set -o affinity=round-robin or set -o rm=defer
+int ksh_set(char** args)
+{
+    if (args[1] == NULL || strcmp(args[1], "-o") != 0)
+    {
+        fprintf(stderr, "Usage: set -o [<name>=<value>]\n");
+        ksh_last_status = 2;
+        return 1;
+    }
+
+    ksh_last_status = 0;
+    if (args[2] == NULL)
+    {
+        printf("affinity    %s\n", ksh_affinity_policy_name());
+        printf("rm          %s\n", ksh_trash_defer ? "defer" : "now");
+        return 1;
+    }
+
+    char* value = strchr(args[2], '=');
+    if (value != NULL && strncmp(args[2], "affinity=", 9) == 0)
+    {
+        if (ksh_affinity_set_policy(value + 1) != 0)
+        {
+            fprintf(stderr, "ksh: set: affinity must be none, round-robin, node-local or explicit:<cpu-list>\n");
+            ksh_last_status = 1;
+        }
+    }
+    else if (value != NULL && strncmp(args[2], "rm=", 3) == 0)
+    {
+        if (strcmp(value + 1, "defer") == 0) ksh_trash_defer = 1;
+        else if (strcmp(value + 1, "now") == 0) ksh_trash_defer = 0;
+        else
+        {
+            fprintf(stderr, "ksh: set: rm must be defer or now\n");
+            ksh_last_status = 1;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "ksh: set: unknown option \'%s\'\n", args[2]);
+        ksh_last_status = 1;
+    }
+    return 1;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <linux/limits.h>
+
 // Function declarations for built-in shell commands
 int ksh_cd(char** args);
 int ksh_ls(char** args);
@@ -13,6 +15,17 @@ int ksh_rmdir(char** args);
 int ksh_rm(char** args);
 int ksh_touch(char** args);
 int ksh_chmod(char** args);
+int ksh_cksum(char** args);
+int ksh_find(char** args);
+int ksh_wc(char** args);
+int ksh_sort(char** args);
+int ksh_tail(char** args);
+int ksh_pin(char** args);
+int ksh_set(char** args);
+int ksh_memo(char** args);
+int ksh_trace(char** args);
+int ksh_source(char** args);
+int ksh_trash(char** args);
 int ksh_help(char** args);
 int ksh_exit(char** args);
 
@@ -22,4 +35,9 @@ extern int (*builtin_func[]) (char**);
 // use extern to declare the variables in the header file
 
 // Number of built-in commands
-int ksh_num_builtins();
\ No newline at end of file
+int ksh_num_builtins();
+
+// Helpers shared by built-in commands
+int ksh_mkdirs(char* path);
+int ksh_path(char path[PATH_MAX], const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+int ksh_cache_dir(const char* env, const char* sub, char dir[PATH_MAX]);
\ No newline at end of file
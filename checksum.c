@@ -0,0 +1,576 @@
+#include "checksum.h"
+#include "built-in.h"
+#include "pool.h"
+#include "launch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KSH_HAVE_X86 1
+#endif
+
+// 1. CRC32C (Castagnoli polynomial, reflected form 0x82F63B78)
+static uint32_t crc32c_table[256];
+
+static void crc32c_init_table(void)
+{
+    for (uint32_t i = 0; i < 256; i ++ )
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k ++ ) c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+        crc32c_table[i] = c;
+    }
+}
+
+// (1) portable fallback: one table lookup per byte
+static uint32_t crc32c_portable(uint32_t crc, const uint8_t* p, size_t len)
+{
+    while (len -- ) crc = crc32c_table[(crc ^ *p ++ ) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef KSH_HAVE_X86
+// (2) SSE4.2 has a 'crc32' instruction for exactly this polynomial, 8 bytes at a time
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t* p, size_t len)
+{
+    while (len && ((uintptr_t) p & 7)) { crc = _mm_crc32_u8(crc, *p ++ ); len -- ; }
+#ifdef __x86_64__
+    uint64_t c64 = crc;
+    for (; len >= 8; len -= 8, p += 8) c64 = _mm_crc32_u64(c64, *(const uint64_t*) p);
+    crc = (uint32_t) c64;
+#endif
+    for (; len >= 4; len -= 4, p += 4) crc = _mm_crc32_u32(crc, *(const uint32_t*) p);
+    while (len -- ) crc = _mm_crc32_u8(crc, *p ++ );
+    return crc;
+}
+#endif
+
+// (3) the CRC-32 of POSIX cksum: polynomial 0x04C11DB7, most significant bit
+//     first, with the length appended. Only there to match cksum's output;
+//     crc32c and xxh64 are the fast choices.
+static uint32_t crc_posix_table[256];
+
+static void crc_posix_init_table(void)
+{
+    for (uint32_t i = 0; i < 256; i ++ )
+    {
+        uint32_t c = i << 24;
+        for (int k = 0; k < 8; k ++ ) c = (c & 0x80000000) ? (c << 1) ^ 0x04C11DB7 : c << 1;
+        crc_posix_table[i] = c;
+    }
+}
+
+static uint32_t crc_posix(uint32_t crc, const uint8_t* p, size_t len)
+{
+    while (len -- ) crc = (crc << 8) ^ crc_posix_table[(crc >> 24) ^ *p ++ ];
+    return crc;
+}
+
+// 2. xxHash64
+// xxHash64 is already four independent 64-bit lanes of scalar multiplies,
+// which the CPU pipelines well, so it has no separate SIMD kernel
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+static inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline uint64_t read64(const uint8_t* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static inline uint32_t read32(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_P2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_P1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t h, uint64_t acc)
+{
+    h ^= xxh64_round(0, acc);
+    return h * XXH_P1 + XXH_P4;
+}
+
+// Consume whole 32-byte stripes, return the number of bytes used
+static size_t xxh64_stripes(uint64_t acc[4], const uint8_t* p, size_t len)
+{
+    size_t done = 0;
+    uint64_t v1 = acc[0], v2 = acc[1], v3 = acc[2], v4 = acc[3];
+    for (; done + 32 <= len; done += 32)
+    {
+        v1 = xxh64_round(v1, read64(p + done));
+        v2 = xxh64_round(v2, read64(p + done + 8));
+        v3 = xxh64_round(v3, read64(p + done + 16));
+        v4 = xxh64_round(v4, read64(p + done + 24));
+    }
+    acc[0] = v1; acc[1] = v2; acc[2] = v3; acc[3] = v4;
+    return done;
+}
+
+static uint64_t xxh64_digest(const ksh_hash_ctx* ctx)
+{
+    uint64_t h;
+    const uint8_t* p = ctx->buf;
+    size_t len = ctx->buflen;
+
+    if (ctx->length >= 32)
+    {
+        h = rotl64(ctx->acc[0], 1) + rotl64(ctx->acc[1], 7) + rotl64(ctx->acc[2], 12) + rotl64(ctx->acc[3], 18);
+        for (int i = 0; i < 4; i ++ ) h = xxh64_merge(h, ctx->acc[i]);
+    }
+    else h = ctx->acc[2] + XXH_P5;      // acc[2] holds the seed until a stripe is processed
+    h += ctx->length;
+
+    for (; len >= 8; len -= 8, p += 8) h = rotl64(h ^ xxh64_round(0, read64(p)), 27) * XXH_P1 + XXH_P4;
+    if (len >= 4) { h = rotl64(h ^ (read32(p) * XXH_P1), 23) * XXH_P2 + XXH_P3; len -= 4; p += 4; }
+    while (len -- ) h = rotl64(h ^ (*p ++ * XXH_P5), 11) * XXH_P1;
+
+    // final avalanche so every input bit affects every output bit
+    h ^= h >> 33; h *= XXH_P2;
+    h ^= h >> 29; h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// 3. SHA-256
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr32(uint32_t x, int r) { return (x >> r) | (x << (32 - r)); }
+
+// (1) portable fallback, straight from FIPS 180-4
+static void sha256_blocks_portable(uint32_t state[8], const uint8_t* p, size_t nblocks)
+{
+    for (; nblocks -- ; p += 64)
+    {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i ++ )
+            w[i] = (uint32_t) p[4 * i] << 24 | (uint32_t) p[4 * i + 1] << 16 | (uint32_t) p[4 * i + 2] << 8 | p[4 * i + 3];
+        for (int i = 16; i < 64; i ++ )
+        {
+            uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i ++ )
+        {
+            uint32_t t1 = h + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+            uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+#ifdef KSH_HAVE_X86
+// (2) SHA-NI: sha256rnds2 does two rounds per instruction and
+//     sha256msg1/sha256msg2 compute the message schedule four words at a time
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_shani(uint32_t state[8], const uint8_t* p, size_t nblocks)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_loadu_si128((const __m128i*) &state[0]);
+    __m128i st1 = _mm_loadu_si128((const __m128i*) &state[4]);
+    // The instructions want the state as ABEF / CDGH instead of ABCD / EFGH
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    st1 = _mm_shuffle_epi32(st1, 0x1B);
+    __m128i st0 = _mm_alignr_epi8(tmp, st1, 8);
+    st1 = _mm_blend_epi16(st1, tmp, 0xF0);
+
+    for (; nblocks -- ; p += 64)
+    {
+        __m128i abef = st0, cdgh = st1;
+        __m128i m[4];
+        for (int i = 0; i < 4; i ++ ) m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (p + 16 * i)), bswap);
+
+        // 16 groups of four rounds; m[g & 3] holds W[4g .. 4g+3]
+        for (int g = 0; g < 16; g ++ )
+        {
+            __m128i cur = m[g & 3];
+            __m128i msg = _mm_add_epi32(cur, _mm_loadu_si128((const __m128i*) &sha256_k[4 * g]));
+            st1 = _mm_sha256rnds2_epu32(st1, st0, msg);
+            if (g >= 3 && g < 15)
+            {
+                __m128i* next = &m[(g + 1) & 3];
+                *next = _mm_add_epi32(*next, _mm_alignr_epi8(cur, m[(g - 1) & 3], 4));
+                *next = _mm_sha256msg2_epu32(*next, cur);
+            }
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            st0 = _mm_sha256rnds2_epu32(st0, st1, msg);
+            if (g >= 1 && g < 13) m[(g - 1) & 3] = _mm_sha256msg1_epu32(m[(g - 1) & 3], cur);
+        }
+
+        st0 = _mm_add_epi32(st0, abef);
+        st1 = _mm_add_epi32(st1, cdgh);
+    }
+
+    // Back from ABEF / CDGH to ABCD / EFGH
+    tmp = _mm_shuffle_epi32(st0, 0x1B);
+    st1 = _mm_shuffle_epi32(st1, 0xB1);
+    st0 = _mm_blend_epi16(tmp, st1, 0xF0);
+    st1 = _mm_alignr_epi8(st1, tmp, 8);
+    _mm_storeu_si128((__m128i*) &state[0], st0);
+    _mm_storeu_si128((__m128i*) &state[4], st1);
+}
+#endif
+
+// 4. Pick the fastest kernels this CPU supports, once per process
+static uint32_t (*crc32c_kernel)(uint32_t, const uint8_t*, size_t) = crc32c_portable;
+static void (*sha256_kernel)(uint32_t*, const uint8_t*, size_t) = sha256_blocks_portable;
+static pthread_once_t ksh_hash_once = PTHREAD_ONCE_INIT;
+
+static void ksh_hash_dispatch(void)
+{
+    crc32c_init_table();
+    crc_posix_init_table();
+#ifdef KSH_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) crc32c_kernel = crc32c_sse42;
+    if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) sha256_kernel = sha256_blocks_shani;
+#endif
+}
+
+// 5. Streaming interface
+uint32_t ksh_crc32c(uint32_t crc, const void* data, size_t len)
+{
+    pthread_once(&ksh_hash_once, ksh_hash_dispatch);
+    return ~crc32c_kernel(~crc, data, len);
+}
+
+void ksh_hash_init(ksh_hash_ctx* ctx, int algo)
+{
+    static const uint32_t sha256_iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    pthread_once(&ksh_hash_once, ksh_hash_dispatch);
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->algo = algo;
+    if (algo == KSH_HASH_XXH64)
+    {
+        // seed 0
+        ctx->acc[0] = XXH_P1 + XXH_P2;
+        ctx->acc[1] = XXH_P2;
+        ctx->acc[2] = 0;
+        ctx->acc[3] = -XXH_P1;
+    }
+    else if (algo == KSH_HASH_SHA256) memcpy(ctx->sha, sha256_iv, sizeof(sha256_iv));
+}
+
+void ksh_hash_update(ksh_hash_ctx* ctx, const void* data, size_t len)
+{
+    const uint8_t* p = data;
+    ctx->length += len;
+
+    if (ctx->algo == KSH_HASH_CRC32C)
+    {
+        ctx->crc = ksh_crc32c(ctx->crc, p, len);
+        return;
+    }
+    if (ctx->algo == KSH_HASH_CRC)
+    {
+        ctx->crc = crc_posix(ctx->crc, p, len);
+        return;
+    }
+
+    // xxHash64 works on 32-byte stripes, SHA-256 on 64-byte blocks
+    size_t block = (ctx->algo == KSH_HASH_XXH64) ? 32 : 64;
+
+    // (1) top up a partially filled block first
+    if (ctx->buflen)
+    {
+        size_t take = block - ctx->buflen;
+        if (take > len) take = len;
+        memcpy(ctx->buf + ctx->buflen, p, take);
+        ctx->buflen += take;
+        p += take;
+        len -= take;
+        if (ctx->buflen < block) return;
+        if (ctx->algo == KSH_HASH_XXH64) xxh64_stripes(ctx->acc, ctx->buf, block);
+        else sha256_kernel(ctx->sha, ctx->buf, 1);
+        ctx->buflen = 0;
+    }
+
+    // (2) hash whole blocks straight from the caller's buffer
+    size_t done;
+    if (ctx->algo == KSH_HASH_XXH64) done = xxh64_stripes(ctx->acc, p, len);
+    else
+    {
+        sha256_kernel(ctx->sha, p, len / 64);
+        done = len & ~(size_t) 63;
+    }
+
+    // (3) keep the tail for the next call
+    memcpy(ctx->buf, p + done, len - done);
+    ctx->buflen = len - done;
+}
+
+void ksh_hash_final(ksh_hash_ctx* ctx, char hex[KSH_HASH_MAX_HEX])
+{
+    if (ctx->algo == KSH_HASH_CRC32C) snprintf(hex, KSH_HASH_MAX_HEX, "%08x", ctx->crc);
+    else if (ctx->algo == KSH_HASH_CRC)
+    {
+        // the length goes in least significant byte first, without leading zeros
+        uint32_t crc = ctx->crc;
+        for (uint64_t n = ctx->length; n; n >>= 8)
+        {
+            uint8_t c = n & 0xff;
+            crc = crc_posix(crc, &c, 1);
+        }
+        snprintf(hex, KSH_HASH_MAX_HEX, "%u %llu", ~crc, (unsigned long long) ctx->length);
+    }
+    else if (ctx->algo == KSH_HASH_XXH64) snprintf(hex, KSH_HASH_MAX_HEX, "%016llx", (unsigned long long) xxh64_digest(ctx));
+    else
+    {
+        // Padding: a single 1 bit, zeros, then the message length in bits (big endian)
+        uint64_t bits = ctx->length * 8;
+        unsigned char pad[128] = { 0x80 };
+        size_t padlen = (ctx->buflen < 56) ? 56 - ctx->buflen : 120 - ctx->buflen;
+        for (int i = 0; i < 8; i ++ ) pad[padlen + i] = (unsigned char) (bits >> (56 - 8 * i));
+        uint64_t saved = ctx->length;
+        ksh_hash_update(ctx, pad, padlen + 8);
+        ctx->length = saved;
+
+        for (int i = 0; i < 8; i ++ ) snprintf(hex + 8 * i, KSH_HASH_MAX_HEX - 8 * i, "%08x", ctx->sha[i]);
+    }
+}
+
+uint64_t ksh_xxh64(const void* data, size_t len, uint64_t seed)
+{
+    ksh_hash_ctx ctx;
+    ksh_hash_init(&ctx, KSH_HASH_XXH64);
+    ctx.acc[0] += seed; ctx.acc[1] += seed; ctx.acc[2] += seed; ctx.acc[3] += seed;
+    ksh_hash_update(&ctx, data, len);
+    return xxh64_digest(&ctx);
+}
+
+// 6. Hash a whole file ("-" is standard input)
+// Large reads, with the kernel told to read ahead. Not mmap: a file
+// truncated while it is being hashed would raise SIGBUS and kill the shell.
+int ksh_hash_file(const char* path, int algo, char hex[KSH_HASH_MAX_HEX])
+{
+    ksh_hash_ctx ctx;
+    int fd = (strcmp(path, "-") == 0) ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    ksh_hash_init(&ctx, algo);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);     // fails harmlessly on pipes
+    char* buf = malloc(KSH_IO_CHUNK);
+    if (!buf) ksh_allocate_error();
+    ssize_t n;
+    while ((n = read(fd, buf, KSH_IO_CHUNK)) > 0) ksh_hash_update(&ctx, buf, n);
+    int saved_errno = errno;
+    free(buf);
+    if (fd != STDIN_FILENO) close(fd);
+    if (n < 0)
+    {
+        errno = saved_errno;
+        return -1;
+    }
+    ksh_hash_final(&ctx, hex);
+    return 0;
+}
+
+// 7. cksum / sha256sum command
+// cksum [-a crc|crc32c|xxh64|sha256] [-c] [file...]
+// Plain cksum prints the POSIX "<crc> <size> <file>". With another algorithm
+// the lines are "<digest>  <file>", the coreutils format; "cksum -c" tells
+// the algorithm of each line by its digest length (8, 16 or 64 hex digits),
+// so it verifies sha256sum manifests too.
+struct cksum_job {
+    char* path;
+    int algo;
+    char expected[KSH_HASH_MAX_HEX];    // -c mode only
+    char hex[KSH_HASH_MAX_HEX];
+    int err;                            // errno if the file could not be read
+};
+
+static void cksum_worker(int i, void* arg)
+{
+    struct cksum_job* job = &((struct cksum_job*) arg)[i];
+    job->err = (ksh_hash_file(job->path, job->algo, job->hex) == 0) ? 0 : errno;
+}
+
+static int cksum_algo(const char* name)
+{
+    if (strcmp(name, "crc") == 0) return KSH_HASH_CRC;
+    if (strcmp(name, "crc32c") == 0) return KSH_HASH_CRC32C;
+    if (strcmp(name, "xxh64") == 0) return KSH_HASH_XXH64;
+    if (strcmp(name, "sha256") == 0) return KSH_HASH_SHA256;
+    return -1;
+}
+
+// Algorithm of a hex digest, from its length
+static int cksum_algo_of(const char* digest, size_t len)
+{
+    if (strspn(digest, "0123456789abcdefABCDEF") < len) return -1;
+    if (len == 8) return KSH_HASH_CRC32C;
+    if (len == 16) return KSH_HASH_XXH64;
+    if (len == 64) return KSH_HASH_SHA256;
+    return -1;
+}
+
+// Read "<digest>  <file>" lines from a manifest and append them to jobs;
+// algo is the one given with -a, or -1 to go by each digest's length
+static int cksum_read_manifest(const char* manifest, int algo, struct cksum_job** jobs, int* njobs, int* cap)
+{
+    FILE* f = (strcmp(manifest, "-") == 0) ? stdin : fopen(manifest, "r");
+    if (f == NULL) return -1;
+
+    char* line = NULL;
+    size_t linecap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &linecap, f)) != -1)
+    {
+        if (len > 0 && line[len - 1] == '\n') line[ -- len] = '\0';
+        char* sep = strchr(line, ' ');
+        int line_algo = sep ? cksum_algo_of(line, sep - line) : -1;
+        // The digest is followed by a space and ' ' (text mode) or '*' (binary mode)
+        if (sep == NULL || line_algo < 0 || (algo >= 0 && line_algo != algo) ||
+            (sep[1] != ' ' && sep[1] != '*') || sep[2] == '\0')
+        {
+            fprintf(stderr, "ksh: cksum: %s: improperly formatted line skipped\n", manifest);
+            continue;
+        }
+
+        if (*njobs == *cap)
+        {
+            *cap = *cap ? *cap * 2 : 64;
+            *jobs = realloc(*jobs, sizeof(struct cksum_job) * *cap);
+            if (!*jobs) ksh_allocate_error();
+        }
+        struct cksum_job* job = &(*jobs)[( *njobs) ++ ];
+        memset(job, 0, sizeof(*job));
+        job->algo = line_algo;
+        memcpy(job->expected, line, sep - line);
+        job->path = strdup(sep + 2);
+        if (!job->path) ksh_allocate_error();
+    }
+    free(line);
+    if (f != stdin) fclose(f);
+    return 0;
+}
+
+int ksh_cksum(char** args)
+{
+    int algo = (strcmp(args[0], "sha256sum") == 0) ? KSH_HASH_SHA256 : KSH_HASH_CRC;
+    int chosen = algo == KSH_HASH_SHA256;     // sha256sum, or cksum -a
+    int check = 0;
+    int i = 1;
+
+    // Parse the options
+    while (args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0')
+    {
+        if (strcmp(args[i], "-c") == 0 || strcmp(args[i], "--check") == 0) check = 1;
+        else if (strcmp(args[i], "-a") == 0 && args[i + 1] != NULL)
+        {
+            if ((algo = cksum_algo(args[ ++ i])) < 0)
+            {
+                fprintf(stderr, "ksh: cksum: unknown algorithm \'%s\' (crc, crc32c, xxh64, sha256)\n", args[i]);
+                ksh_last_status = 1;
+                return 1;
+            }
+            chosen = 1;
+        }
+        else
+        {
+            fprintf(stderr, "ksh: unknown option \'%s\'...\n", args[i]);
+            ksh_last_status = 1;
+            return 1;
+        }
+        i ++ ;
+    }
+    if (check && algo == KSH_HASH_CRC && chosen)
+    {
+        fprintf(stderr, "ksh: cksum: -c needs crc32c, xxh64 or sha256 digests\n");
+        ksh_last_status = 1;
+        return 1;
+    }
+
+    // Collect the files to hash; with no file operands read standard input
+    char* stdin_only[] = { "-", NULL };
+    char** files = (args[i] != NULL) ? &args[i] : stdin_only;
+    struct cksum_job* jobs = NULL;
+    int njobs = 0, cap = 0;
+    int bad_manifest = 0;
+
+    for (int f = 0; files[f] != NULL; f ++ )
+    {
+        if (check)
+        {
+            if (cksum_read_manifest(files[f], chosen ? algo : -1, &jobs, &njobs, &cap) != 0)
+            {
+                fprintf(stderr, "ksh: cksum: %s: %s\n", files[f], strerror(errno));
+                bad_manifest = 1;
+            }
+            continue;
+        }
+        if (njobs == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            jobs = realloc(jobs, sizeof(struct cksum_job) * cap);
+            if (!jobs) ksh_allocate_error();
+        }
+        memset(&jobs[njobs], 0, sizeof(struct cksum_job));
+        jobs[njobs].algo = algo;
+        jobs[njobs ++ ].path = strdup(files[f]);
+    }
+
+    // Hash all files in parallel, then report in the original order
+    ksh_parallel_for(njobs, cksum_worker, jobs);
+
+    int failed = 0, unreadable = 0;
+    for (int j = 0; j < njobs; j ++ )
+    {
+        if (jobs[j].err)
+        {
+            fprintf(stderr, "ksh: cksum: %s: %s\n", jobs[j].path, strerror(jobs[j].err));
+            if (check) printf("%s: FAILED open or read\n", jobs[j].path);
+            unreadable ++ ;
+        }
+        else if (!check && algo == KSH_HASH_CRC)
+        {
+            // like POSIX cksum, standard input has no name column
+            if (files == stdin_only) printf("%s\n", jobs[j].hex);
+            else printf("%s %s\n", jobs[j].hex, jobs[j].path);
+        }
+        else if (!check) printf("%s  %s\n", jobs[j].hex, jobs[j].path);
+        else if (strcasecmp(jobs[j].hex, jobs[j].expected) == 0) printf("%s: OK\n", jobs[j].path);
+        else
+        {
+            printf("%s: FAILED\n", jobs[j].path);
+            failed ++ ;
+        }
+        free(jobs[j].path);
+    }
+    free(jobs);
+
+    if (check && unreadable) fprintf(stderr, "ksh: cksum: WARNING: %d listed file%s could not be read\n", unreadable, unreadable == 1 ? "" : "s");
+    if (check && failed) fprintf(stderr, "ksh: cksum: WARNING: %d computed checksum%s did NOT match\n", failed, failed == 1 ? "" : "s");
+    ksh_last_status = (failed || unreadable || bad_manifest) ? 1 : 0;
+    return 1;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Checksum algorithms supported by the 'cksum' built-in
+#define KSH_HASH_CRC32C 0
+#define KSH_HASH_XXH64  1
+#define KSH_HASH_SHA256 2
+#define KSH_HASH_CRC    3       // POSIX cksum; its digest is "<crc> <size>"
+
+#define KSH_HASH_MAX_HEX 65     // longest hex digest (SHA-256) plus '\0'
+#define KSH_IO_CHUNK (1 << 20)  // 1 MB per read() when hashing a file
+
+// Streaming state for one checksum computation
+typedef struct ksh_hash_ctx {
+    int algo;                   // one of KSH_HASH_*
+    uint64_t length;            // total number of bytes hashed so far
+    uint32_t crc;               // CRC32C or POSIX CRC register
+    uint64_t acc[4];            // xxHash64 accumulators
+    uint32_t sha[8];            // SHA-256 chaining state
+    unsigned char buf[64];      // pending bytes of an incomplete block
+    size_t buflen;
+} ksh_hash_ctx;
+
+// Function declarations for checksums, also used by other built-ins
+void ksh_hash_init(ksh_hash_ctx* ctx, int algo);
+void ksh_hash_update(ksh_hash_ctx* ctx, const void* data, size_t len);
+void ksh_hash_final(ksh_hash_ctx* ctx, char hex[KSH_HASH_MAX_HEX]);
+int ksh_hash_file(const char* path, int algo, char hex[KSH_HASH_MAX_HEX]);
+
+// One-shot helpers
+uint32_t ksh_crc32c(uint32_t crc, const void* data, size_t len);
+uint64_t ksh_xxh64(const void* data, size_t len, uint64_t seed);
@@ -0,0 +1,301 @@
+#include "delta.h"
+#include "checksum.h"
+#include "built-in.h"
+#include "launch.h"
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <linux/limits.h>
+
+// cp --update rewrites only the chunks of the destination that differ from
+// the source. Chunks are fixed-size and compared in place: a sync never
+// shifts data, so a rolling hash would find nothing more. Groups of chunks
+// are spread over the worker pool, each group reads its source chunks with
+// pread(), hashes them with xxh64, compares them and pwrite()s each run of
+// changed chunks at once. Neither file is mapped: one truncated during the
+// copy would raise SIGBUS and kill the shell.
+//
+// After a sync the chunk hashes of the destination are kept in a signature
+// file (~/.cache/ksh/delta, or $KSH_DELTA_DIR) together with the file's
+// inode, size, mtime and ctime. While those still match, the next sync
+// compares against the signature and never reads the destination at all;
+// otherwise it compares the bytes of both files directly.
+
+#define KSH_DELTA_CHUNK (256 << 10)     // 256 KB
+#define KSH_DELTA_GROUP 64              // chunks per work item (16 MB)
+#define KSH_DELTA_RUN 16                // changed chunks buffered per pwrite (4 MB)
+#define KSH_DELTA_MAGIC 0x4154474c4448534bULL
+#define KSH_DELTA_VERSION 1
+
+struct delta_sig_header {
+    uint64_t magic;
+    uint32_t version, chunk;
+    uint64_t dev, ino, size;
+    int64_t mtime_sec, mtime_nsec, ctime_sec, ctime_nsec;
+    int64_t nchunks;
+};
+
+struct delta_job {
+    int sfd, dfd;
+    int compare;                // no signature: read the destination and compare bytes
+    uint64_t size, old_size;
+    const uint64_t* sig;        // destination chunk hashes from the last sync, or NULL
+    int64_t nsig;
+    uint64_t* hashes;           // source chunk hashes, saved as the next signature
+    int nchunks;
+    uint64_t written;           // updated atomically by the workers
+    int changed;
+    int error;                  // first errno from pread or pwrite
+};
+
+// 1. Signature files
+static int delta_sig_path(const struct stat* st, char path[PATH_MAX])
+{
+    char dir[PATH_MAX];
+    if (ksh_cache_dir("KSH_DELTA_DIR", "delta", dir) != 0) return -1;
+    return ksh_path(path, "%s/%llx-%llx.sig", dir, (unsigned long long) st->st_dev, (unsigned long long) st->st_ino);
+}
+
+static void delta_sig_fill(struct delta_sig_header* h, const struct stat* st, int64_t nchunks)
+{
+    memset(h, 0, sizeof(*h));
+    h->magic = KSH_DELTA_MAGIC;
+    h->version = KSH_DELTA_VERSION;
+    h->chunk = KSH_DELTA_CHUNK;
+    h->dev = st->st_dev;
+    h->ino = st->st_ino;
+    h->size = st->st_size;
+    h->mtime_sec = st->st_mtim.tv_sec;
+    h->mtime_nsec = st->st_mtim.tv_nsec;
+    h->ctime_sec = st->st_ctim.tv_sec;
+    h->ctime_nsec = st->st_ctim.tv_nsec;
+    h->nchunks = nchunks;
+}
+
+// Hashes of the destination as of the last sync, or NULL if it has been
+// touched since (ctime cannot be set back, so any write shows up)
+static uint64_t* delta_sig_load(const struct stat* st, int64_t* nchunks)
+{
+    char path[PATH_MAX];
+    struct delta_sig_header want, h;
+    if (delta_sig_path(st, path) != 0) return NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    uint64_t* sig = NULL;
+    if (read(fd, &h, sizeof(h)) == sizeof(h))
+    {
+        delta_sig_fill(&want, st, h.nchunks);
+        if (memcmp(&h, &want, sizeof(h)) == 0 && h.nchunks >= 0 &&
+            h.nchunks == (int64_t) ((h.size + KSH_DELTA_CHUNK - 1) / KSH_DELTA_CHUNK))
+        {
+            size_t bytes = sizeof(uint64_t) * h.nchunks;
+            sig = malloc(bytes ? bytes : 1);
+            if (!sig) ksh_allocate_error();
+            if (bytes && read(fd, sig, bytes) != (ssize_t) bytes)
+            {
+                free(sig);
+                sig = NULL;
+            }
+            *nchunks = h.nchunks;
+        }
+    }
+    close(fd);
+    return sig;
+}
+
+static void delta_sig_save(const struct stat* st, const uint64_t* hashes, int64_t nchunks)
+{
+    char path[PATH_MAX], tmp[PATH_MAX];
+    struct delta_sig_header h;
+    if (delta_sig_path(st, path) != 0 || ksh_path(tmp, "%s.%d", path, (int) getpid()) != 0) return;
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return;
+    delta_sig_fill(&h, st, nchunks);
+    size_t bytes = sizeof(uint64_t) * nchunks;
+    int ok = write(fd, &h, sizeof(h)) == sizeof(h) && (bytes == 0 || write(fd, hashes, bytes) == (ssize_t) bytes);
+    if (close(fd) != 0 || !ok || rename(tmp, path) != 0) unlink(tmp);
+}
+
+// 2. Compare and rewrite
+static void delta_fail(struct delta_job* job, int err)
+{
+    int expected = 0;
+    __atomic_compare_exchange_n(&job->error, &expected, err, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+// Read exactly len bytes at off; returns the number read, short when the file shrank
+static size_t delta_read(int fd, unsigned char* buf, size_t len, uint64_t off)
+{
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t n = pread(fd, buf + got, len - got, off + got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += n;
+    }
+    return got;
+}
+
+static int delta_chunk_same(const struct delta_job* job, int i, uint64_t off, size_t len, const unsigned char* src, unsigned char* old)
+{
+    if (off + len > job->old_size) return 0;
+    if (!job->compare) return i < job->nsig && job->sig[i] == job->hashes[i];
+    return delta_read(job->dfd, old, len, off) == len && memcmp(src, old, len) == 0;
+}
+
+static void delta_flush(struct delta_job* job, const unsigned char* data, uint64_t start, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = pwrite(job->dfd, data, len, start);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0)
+        {
+            delta_fail(job, n < 0 ? errno : EIO);
+            return;
+        }
+        __atomic_fetch_add(&job->written, (uint64_t) n, __ATOMIC_RELAXED);
+        data += n;
+        start += n;
+        len -= n;
+    }
+}
+
+static void delta_group_worker(int g, void* arg)
+{
+    struct delta_job* job = arg;
+    int first = g * KSH_DELTA_GROUP;
+    int last = first + KSH_DELTA_GROUP < job->nchunks ? first + KSH_DELTA_GROUP : job->nchunks;
+    unsigned char* run = malloc((size_t) KSH_DELTA_RUN * KSH_DELTA_CHUNK);     // pending run of changed chunks
+    unsigned char* old = job->compare ? malloc(KSH_DELTA_CHUNK) : NULL;
+    if (!run || (job->compare && !old)) ksh_allocate_error();
+    uint64_t run_start = 0;
+    size_t run_len = 0;
+    int changed = 0;
+
+    for (int i = first; i < last && !__atomic_load_n(&job->error, __ATOMIC_RELAXED); i ++ )
+    {
+        uint64_t off = (uint64_t) i * KSH_DELTA_CHUNK;
+        size_t len = job->size - off < KSH_DELTA_CHUNK ? job->size - off : KSH_DELTA_CHUNK;
+
+        // read straight to the end of the pending run, where it stays if it changed
+        unsigned char* src = run + run_len;
+        errno = 0;
+        if (delta_read(job->sfd, src, len, off) != len)
+        {
+            delta_fail(job, errno ? errno : EIO);      // the source shrank under us
+            break;
+        }
+        job->hashes[i] = ksh_xxh64(src, len, 0);
+        if (delta_chunk_same(job, i, off, len, src, old))
+        {
+            delta_flush(job, run, run_start, run_len);
+            run_len = 0;
+            continue;
+        }
+
+        // chunks of a group are consecutive, so a changed chunk always extends the run
+        changed ++ ;
+        if (run_len == 0) run_start = off;
+        run_len += len;
+        if (run_len == (size_t) KSH_DELTA_RUN * KSH_DELTA_CHUNK)
+        {
+            delta_flush(job, run, run_start, run_len);
+            run_len = 0;
+        }
+    }
+    delta_flush(job, run, run_start, run_len);
+    __atomic_fetch_add(&job->changed, changed, __ATOMIC_RELAXED);
+    free(run);
+    free(old);
+}
+
+// Returns 0 on success, -1 with errno set on failure
+int ksh_delta_copy(const char* src, const char* dst, struct ksh_delta_stats* stats)
+{
+    struct stat sst, dst_st;
+    memset(stats, 0, sizeof(*stats));
+
+    int sfd = open(src, O_RDONLY | O_CLOEXEC);
+    if (sfd < 0) return -1;
+    if (fstat(sfd, &sst) != 0 || !S_ISREG(sst.st_mode))
+    {
+        // only regular files can be compared in place
+        int saved = fstat(sfd, &sst) != 0 ? errno : EINVAL;
+        close(sfd);
+        errno = saved;
+        return -1;
+    }
+    stats->size = sst.st_size;
+
+    // (1) quick check: same size and mtime means nothing to do
+    if (stat(dst, &dst_st) == 0 && S_ISREG(dst_st.st_mode) && dst_st.st_size == sst.st_size &&
+        dst_st.st_mtim.tv_sec == sst.st_mtim.tv_sec && dst_st.st_mtim.tv_nsec == sst.st_mtim.tv_nsec)
+    {
+        stats->skipped = 1;
+        close(sfd);
+        return 0;
+    }
+
+    // (2) open the destination without truncating it
+    int dfd = open(dst, O_RDWR | O_CREAT | O_CLOEXEC, sst.st_mode & 0777);
+    if (dfd < 0 || fstat(dfd, &dst_st) != 0)
+    {
+        int saved = errno;
+        if (dfd >= 0) close(dfd);
+        close(sfd);
+        errno = saved;
+        return -1;
+    }
+
+    struct delta_job job = { 0 };
+    job.sfd = sfd;
+    job.dfd = dfd;
+    job.size = sst.st_size;
+    job.old_size = dst_st.st_size;
+    job.nchunks = (int) ((job.size + KSH_DELTA_CHUNK - 1) / KSH_DELTA_CHUNK);
+    job.hashes = malloc(sizeof(uint64_t) * (job.nchunks ? job.nchunks : 1));
+    if (!job.hashes) ksh_allocate_error();
+    if (job.old_size > 0) job.sig = delta_sig_load(&dst_st, &job.nsig);
+
+    // (3) read the destination too only when there is no signature
+    int r = 0;
+    job.compare = job.sig == NULL && job.old_size > 0;
+    posix_fadvise(sfd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (job.compare) posix_fadvise(dfd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // (4) compare and rewrite in parallel, then fix up the length and times
+    ksh_parallel_for((job.nchunks + KSH_DELTA_GROUP - 1) / KSH_DELTA_GROUP, delta_group_worker, &job);
+    if (job.error)
+    {
+        errno = job.error;
+        r = -1;
+    }
+    if (r == 0 && job.old_size != job.size && ftruncate(dfd, job.size) != 0) r = -1;
+
+    // the copy carries the source's mtime, so the next quick check can skip it
+    struct timespec times[2] = { sst.st_atim, sst.st_mtim };
+    if (r == 0 && futimens(dfd, times) != 0) r = -1;
+    if (r == 0 && fstat(dfd, &dst_st) == 0) delta_sig_save(&dst_st, job.hashes, job.nchunks);
+
+    int saved = errno;
+    free((void*) job.sig);
+    free(job.hashes);
+    close(dfd);
+    close(sfd);
+
+    stats->written = job.written;
+    stats->chunks = job.nchunks;
+    stats->changed = job.changed;
+    errno = saved;
+    return r;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+// Outcome of one delta copy
+struct ksh_delta_stats {
+    uint64_t size;          // bytes in the source
+    uint64_t written;       // bytes actually written to the destination
+    int chunks, changed;    // chunks compared, chunks rewritten
+    int skipped;            // size and mtime matched, nothing was read
+};
+
+// Function declarations for cp --update
+extern int ksh_delta_copy(const char* src, const char* dst, struct ksh_delta_stats* stats);
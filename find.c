@@ -0,0 +1,616 @@
+#include "built-in.h"
+#include "launch.h"
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+
+// find [path...] [-sorted] [-print0] [!] [-name PAT] [-type c] [-size [+-]N[ckMG]]
+//      [-mtime [+-]N] [-newer FILE] [-exec cmd ... {} + | ;]
+//
+// The predicates are compiled once into a flat list of instructions that
+// are AND-ed together, so matching an entry is a short loop with no parsing.
+// Directories are read with getdents64 on an open fd, entries are stat'ed
+// relative to that fd, and only when a predicate needs more than the name
+// and the d_type the kernel already returned.
+
+#define FIND_GETDENTS_BUFSIZE (64 * 1024)
+#define FIND_MAX_QUEUED_FDS 256     // keep at most this many subdirectory fds open in the queues
+
+// 1. Compiled predicate program
+enum find_op { FIND_NAME, FIND_TYPE, FIND_SIZE, FIND_MTIME, FIND_NEWER };
+
+struct find_insn {
+    enum find_op op;
+    int negate;                 // preceded by '!' or '-not'
+    const char* pattern;        // -name
+    char type;                  // -type, one of "fdlbcps"
+    int cmp;                    // -size/-mtime: -1 less than, 0 exactly, +1 greater than
+    long long num;              // -size/-mtime operand
+    long long unit;             // -size unit in bytes
+    struct timespec ref;        // -newer reference mtime
+};
+
+struct find_prog {
+    struct find_insn* code;
+    int len;
+    time_t now;
+    int print0;                 // separate results with '\0' instead of '\n'
+    int sorted;                 // print results in sorted order after the walk
+    char** exec_argv;           // -exec command, NULL terminated, "{}" marks the paths
+    int exec_batch;             // -exec ... {} + (one call for all paths)
+};
+
+// Extract 'f', 'd', ... from either a getdents d_type or a stat mode
+static char find_type_of_dtype(unsigned char d_type)
+{
+    switch (d_type)
+    {
+        case DT_REG: return 'f';
+        case DT_DIR: return 'd';
+        case DT_LNK: return 'l';
+        case DT_BLK: return 'b';
+        case DT_CHR: return 'c';
+        case DT_FIFO: return 'p';
+        case DT_SOCK: return 's';
+        default: return '?';
+    }
+}
+
+static char find_type_of_mode(mode_t mode)
+{
+    if (S_ISREG(mode)) return 'f';
+    if (S_ISDIR(mode)) return 'd';
+    if (S_ISLNK(mode)) return 'l';
+    if (S_ISBLK(mode)) return 'b';
+    if (S_ISCHR(mode)) return 'c';
+    if (S_ISFIFO(mode)) return 'p';
+    if (S_ISSOCK(mode)) return 's';
+    return '?';
+}
+
+// Parse "[+-]N", returns -1 on a malformed number
+static int find_parse_num(const char* s, struct find_insn* insn)
+{
+    char* end;
+    insn->cmp = (*s == '+') ? 1 : (*s == '-') ? -1 : 0;
+    if (insn->cmp) s ++ ;
+    insn->num = strtoll(s, &end, 10);
+    if (end == s) return -1;
+
+    insn->unit = 512;   // like GNU find, a bare number counts 512-byte blocks
+    if (*end == 'c') insn->unit = 1;
+    else if (*end == 'k') insn->unit = 1024;
+    else if (*end == 'M') insn->unit = 1024 * 1024;
+    else if (*end == 'G') insn->unit = 1024 * 1024 * 1024;
+    else if (*end != '\0') return -1;
+    return 0;
+}
+
+static int find_compare(long long value, const struct find_insn* insn)
+{
+    if (insn->cmp > 0) return value > insn->num;
+    if (insn->cmp < 0) return value < insn->num;
+    return value == insn->num;
+}
+
+static int find_count_args(char** args)
+{
+    int n = 0;
+    while (args[n] != NULL) n ++ ;
+    return n;
+}
+
+// Compile the expression in args[i..]; returns -1 after printing an error
+static int find_compile(char** args, int i, struct find_prog* prog)
+{
+    int negate = 0;
+    prog->code = malloc(sizeof(struct find_insn) * (find_count_args(args) + 1));
+    if (!prog->code) ksh_allocate_error();
+
+    for (; args[i] != NULL; i ++ )
+    {
+        struct find_insn* insn = &prog->code[prog->len];
+        memset(insn, 0, sizeof(*insn));
+        insn->negate = negate;
+        negate = 0;
+
+        if (strcmp(args[i], "!") == 0 || strcmp(args[i], "-not") == 0) { negate = !insn->negate; continue; }
+        else if (strcmp(args[i], "-print") == 0) continue;
+        else if (strcmp(args[i], "-print0") == 0) { prog->print0 = 1; continue; }
+        else if (strcmp(args[i], "-sorted") == 0) { prog->sorted = 1; continue; }
+        else if (strcmp(args[i], "-exec") == 0)
+        {
+            int start = ++ i;
+            while (args[i] != NULL && strcmp(args[i], ";") != 0 && strcmp(args[i], "+") != 0) i ++ ;
+            if (args[i] == NULL || i == start)
+            {
+                fprintf(stderr, "ksh: find: missing argument to \'-exec\'\n");
+                return -1;
+            }
+            prog->exec_batch = (strcmp(args[i], "+") == 0);
+            args[i] = NULL;     // terminate the command in place
+            prog->exec_argv = &args[start];
+            break;
+        }
+
+        if (args[i + 1] == NULL)
+        {
+            fprintf(stderr, "ksh: find: missing argument to \'%s\'\n", args[i]);
+            return -1;
+        }
+        const char* arg = args[ ++ i];
+
+        if (strcmp(args[i - 1], "-name") == 0)
+        {
+            insn->op = FIND_NAME;
+            insn->pattern = arg;
+        }
+        else if (strcmp(args[i - 1], "-type") == 0 && strlen(arg) == 1 && strchr("fdlbcps", arg[0]))
+        {
+            insn->op = FIND_TYPE;
+            insn->type = arg[0];
+        }
+        else if (strcmp(args[i - 1], "-size") == 0 && find_parse_num(arg, insn) == 0)
+        {
+            insn->op = FIND_SIZE;
+        }
+        else if (strcmp(args[i - 1], "-mtime") == 0 && find_parse_num(arg, insn) == 0 && insn->unit == 512)
+        {
+            insn->op = FIND_MTIME;
+        }
+        else if (strcmp(args[i - 1], "-newer") == 0)
+        {
+            struct stat st;
+            if (stat(arg, &st) != 0)
+            {
+                fprintf(stderr, "ksh: find: \'%s\': %s\n", arg, strerror(errno));
+                return -1;
+            }
+            insn->op = FIND_NEWER;
+            insn->ref = st.st_mtim;
+        }
+        else
+        {
+            fprintf(stderr, "ksh: find: invalid expression \'%s %s\'\n", args[i - 1], arg);
+            return -1;
+        }
+        prog->len ++ ;
+    }
+    return 0;
+}
+
+// Run the program against one entry, 'name' is relative to 'dirfd'
+static int find_match(const struct find_prog* prog, int dirfd, const char* name, unsigned char d_type)
+{
+    struct stat st;
+    int have_stat = 0;
+
+    for (int pc = 0; pc < prog->len; pc ++ )
+    {
+        const struct find_insn* insn = &prog->code[pc];
+        int r;
+
+        // Only these instructions can be answered without a stat call
+        if (insn->op == FIND_NAME)
+        {
+            const char* base = strrchr(name, '/');
+            r = fnmatch(insn->pattern, (base && base[1]) ? base + 1 : name, 0) == 0;
+            if (insn->negate ? r : !r) return 0;
+            continue;
+        }
+        if (insn->op == FIND_TYPE && d_type != DT_UNKNOWN)
+        {
+            r = find_type_of_dtype(d_type) == insn->type;
+            if (insn->negate ? r : !r) return 0;
+            continue;
+        }
+
+        if (!have_stat)
+        {
+            if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return 0;
+            have_stat = 1;
+        }
+
+        switch (insn->op)
+        {
+            case FIND_TYPE:
+                r = find_type_of_mode(st.st_mode) == insn->type;
+                break;
+            case FIND_SIZE:
+                r = find_compare((st.st_size + insn->unit - 1) / insn->unit, insn);
+                break;
+            case FIND_MTIME:
+                r = find_compare((prog->now - st.st_mtime) / 86400, insn);
+                break;
+            case FIND_NEWER:
+                r = st.st_mtim.tv_sec > insn->ref.tv_sec ||
+                    (st.st_mtim.tv_sec == insn->ref.tv_sec && st.st_mtim.tv_nsec > insn->ref.tv_nsec);
+                break;
+            default:
+                r = 0;
+        }
+        if (insn->negate ? r : !r) return 0;
+    }
+    return 1;
+}
+
+// 2. Work-stealing walker
+// Every worker owns a deque of directories still to be read. It pushes and
+// pops at the tail (depth first, so the directories it just saw are still
+// cached), and idle workers steal from the head of someone else's deque.
+// A worker that finds nothing to steal sleeps on a condition variable until
+// a directory is pushed or the walk is over.
+struct find_dir {
+    char* path;
+    int fd;                     // already opened relative to the parent, or -1
+};
+
+struct find_deque {
+    pthread_mutex_t lock;
+    struct find_dir* items;
+    int head, tail, cap;
+};
+
+struct find_walk {
+    const struct find_prog* prog;
+    struct find_deque* deques;
+    int ndeques;
+    int outstanding;            // directories queued or being read, updated atomically
+    int queued;                 // directories sitting in the deques, updated atomically
+    int queued_fds;             // open fds sitting in the deques, updated atomically
+    int waiting;                // workers asleep on idle, updated atomically
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle;
+    pthread_mutex_t results_lock;
+    char** results;             // collected paths for -sorted and -exec
+    int nresults, results_cap;
+};
+
+static void find_push(struct find_walk* walk, int self, char* path, int fd)
+{
+    struct find_deque* dq = &walk->deques[self];
+    __atomic_fetch_add(&walk->outstanding, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail == dq->cap)
+    {
+        if (dq->head > 0)
+        {
+            // reuse the space freed by steals before growing
+            memmove(dq->items, dq->items + dq->head, sizeof(struct find_dir) * (dq->tail - dq->head));
+            dq->tail -= dq->head;
+            dq->head = 0;
+        }
+        else
+        {
+            dq->cap = dq->cap ? dq->cap * 2 : 64;
+            dq->items = realloc(dq->items, sizeof(struct find_dir) * dq->cap);
+            if (!dq->items) ksh_allocate_error();
+        }
+    }
+    dq->items[dq->tail ++ ] = (struct find_dir) { path, fd };
+    pthread_mutex_unlock(&dq->lock);
+
+    // a sleeper either sees queued go up before it waits, or is waiting
+    // already and gets the signal: both sides go through seq_cst atomics
+    __atomic_fetch_add(&walk->queued, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&walk->waiting, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_mutex_lock(&walk->idle_lock);
+        pthread_cond_signal(&walk->idle);
+        pthread_mutex_unlock(&walk->idle_lock);
+    }
+}
+
+// Pop from the tail of our own deque, or steal from the head of another one
+static int find_take(struct find_walk* walk, int self, struct find_dir* out)
+{
+    for (int k = 0; k < walk->ndeques; k ++ )
+    {
+        struct find_deque* dq = &walk->deques[(self + k) % walk->ndeques];
+        int got = 0;
+        pthread_mutex_lock(&dq->lock);
+        if (dq->head < dq->tail)
+        {
+            *out = (k == 0) ? dq->items[ -- dq->tail] : dq->items[dq->head ++ ];
+            if (dq->head == dq->tail) dq->head = dq->tail = 0;
+            got = 1;
+        }
+        pthread_mutex_unlock(&dq->lock);
+        if (got)
+        {
+            __atomic_fetch_sub(&walk->queued, 1, __ATOMIC_SEQ_CST);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void find_emit(struct find_walk* walk, char* path)
+{
+    const struct find_prog* prog = walk->prog;
+    if (!prog->sorted && !prog->exec_argv)
+    {
+        // a single stdio call per line, so lines from different threads never interleave
+        printf("%s%c", path, prog->print0 ? '\0' : '\n');
+        free(path);
+        return;
+    }
+
+    pthread_mutex_lock(&walk->results_lock);
+    if (walk->nresults == walk->results_cap)
+    {
+        walk->results_cap = walk->results_cap ? walk->results_cap * 2 : 256;
+        walk->results = realloc(walk->results, sizeof(char*) * walk->results_cap);
+        if (!walk->results) ksh_allocate_error();
+    }
+    walk->results[walk->nresults ++ ] = path;
+    pthread_mutex_unlock(&walk->results_lock);
+}
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Read one directory, report matches and queue its subdirectories
+static void find_read_dir(struct find_walk* walk, int self, struct find_dir* dir, char* buf)
+{
+    int fd = dir->fd;
+    if (fd < 0) fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    else __atomic_fetch_sub(&walk->queued_fds, 1, __ATOMIC_RELAXED);
+    if (fd < 0)
+    {
+        fprintf(stderr, "ksh: find: \'%s\': %s\n", dir->path, strerror(errno));
+        return;
+    }
+
+    size_t path_len = strlen(dir->path);
+    int slash = (path_len > 0 && dir->path[path_len - 1] != '/');
+    long nread;
+
+    // getdents64 fills the buffer with as many entries as fit, one syscall per 64 KB
+    while ((nread = syscall(SYS_getdents64, fd, buf, FIND_GETDENTS_BUFSIZE)) > 0)
+    {
+        for (long pos = 0; pos < nread; )
+        {
+            struct linux_dirent64* d = (struct linux_dirent64*) (buf + pos);
+            pos += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+
+            unsigned char d_type = d->d_type;
+            if (d_type == DT_UNKNOWN)
+            {
+                // some file systems do not fill d_type; fall back to one stat
+                struct stat st;
+                if (fstatat(fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+                    d_type = S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN;
+            }
+
+            size_t name_len = strlen(d->d_name);
+            char* path = malloc(path_len + slash + name_len + 1);
+            if (!path) ksh_allocate_error();
+            memcpy(path, dir->path, path_len);
+            if (slash) path[path_len] = '/';
+            memcpy(path + path_len + slash, d->d_name, name_len + 1);
+
+            int matched = find_match(walk->prog, fd, d->d_name, d_type);
+
+            if (d_type == DT_DIR)
+            {
+                char* sub = matched ? strdup(path) : path;
+                if (!sub) ksh_allocate_error();
+                int subfd = -1;
+                // open the subdirectory relative to this one while the fd budget allows
+                if (__atomic_load_n(&walk->queued_fds, __ATOMIC_RELAXED) < FIND_MAX_QUEUED_FDS)
+                {
+                    subfd = openat(fd, d->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                    if (subfd >= 0) __atomic_fetch_add(&walk->queued_fds, 1, __ATOMIC_RELAXED);
+                }
+                find_push(walk, self, sub, subfd);
+            }
+            if (matched) find_emit(walk, path);
+            else if (d_type != DT_DIR) free(path);
+        }
+    }
+    if (nread < 0) fprintf(stderr, "ksh: find: \'%s\': %s\n", dir->path, strerror(errno));
+    close(fd);
+}
+
+static void find_worker(int self, void* arg)
+{
+    struct find_walk* walk = arg;
+    struct find_dir dir;
+    char* buf = malloc(FIND_GETDENTS_BUFSIZE);
+    if (!buf) ksh_allocate_error();
+
+    while (1)
+    {
+        if (find_take(walk, self, &dir))
+        {
+            find_read_dir(walk, self, &dir, buf);
+            free(dir.path);
+            if (__atomic_sub_fetch(&walk->outstanding, 1, __ATOMIC_SEQ_CST) == 0)
+            {
+                // the walk is over: wake everyone so they can leave
+                pthread_mutex_lock(&walk->idle_lock);
+                pthread_cond_broadcast(&walk->idle);
+                pthread_mutex_unlock(&walk->idle_lock);
+            }
+            continue;
+        }
+
+        // nothing to take: sleep until a push, done once no directory is queued or being read
+        pthread_mutex_lock(&walk->idle_lock);
+        __atomic_fetch_add(&walk->waiting, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&walk->queued, __ATOMIC_SEQ_CST) == 0 &&
+               __atomic_load_n(&walk->outstanding, __ATOMIC_SEQ_CST) > 0)
+            pthread_cond_wait(&walk->idle, &walk->idle_lock);
+        __atomic_fetch_sub(&walk->waiting, 1, __ATOMIC_SEQ_CST);
+        int done = __atomic_load_n(&walk->outstanding, __ATOMIC_SEQ_CST) == 0;
+        pthread_mutex_unlock(&walk->idle_lock);
+        if (done) break;
+    }
+    free(buf);
+}
+
+static int find_cmp(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+// 3. Run the -exec command, built-ins run in-process without a fork
+// Bytes left for the paths of one '-exec ... +' call: like xargs, the
+// kernel's ARG_MAX less the environment, the fixed arguments and 2 KB of
+// headroom, counting each string with its NUL and argv pointer
+static long find_exec_room(const struct find_prog* prog)
+{
+    extern char** environ;
+    long room = sysconf(_SC_ARG_MAX);
+    if (room <= 0) room = 128 * 1024;
+    room -= 2048;
+    for (char** e = environ; *e != NULL; e ++ ) room -= strlen(*e) + 1 + sizeof(char*);
+    for (char** a = prog->exec_argv; *a != NULL; a ++ ) room -= strlen(*a) + 1 + sizeof(char*);
+    return room;
+}
+
+// Returns 0 if every call succeeded
+static int find_exec(const struct find_prog* prog, char** paths, int npaths)
+{
+    int argc = 0, slots = 0, failed = 0;
+    while (prog->exec_argv[argc] != NULL)
+        if (strcmp(prog->exec_argv[argc ++ ], "{}") == 0) slots ++ ;
+    long room = find_exec_room(prog);
+
+    int max_call = prog->exec_batch ? npaths : 1;
+    char** argv = malloc(sizeof(char*) * (argc + (size_t) max_call * (slots ? slots : 1) + 1));
+    if (!argv) ksh_allocate_error();
+
+    for (int done = 0, per_call; done < npaths; done += per_call)
+    {
+        // with '+', take paths while they fit (at least one, even if it is too long)
+        per_call = 1;
+        if (prog->exec_batch)
+        {
+            long used = (long) (strlen(paths[done]) + 1 + sizeof(char*)) * slots;
+            while (done + per_call < npaths)
+            {
+                long more = (long) (strlen(paths[done + per_call]) + 1 + sizeof(char*)) * slots;
+                if (used + more > room) break;
+                used += more;
+                per_call ++ ;
+            }
+        }
+
+        int n = 0;
+        for (int a = 0; a < argc; a ++ )
+        {
+            if (strcmp(prog->exec_argv[a], "{}") == 0)
+                for (int p = done; p < done + per_call; p ++ ) argv[n ++ ] = paths[p];
+            else argv[n ++ ] = prog->exec_argv[a];
+        }
+        argv[n] = NULL;
+        ksh_execute(argv);
+        if (ksh_last_status != 0) failed = 1;
+    }
+    free(argv);
+    return failed;
+}
+
+// 4. find command
+int ksh_find(char** args)
+{
+    struct find_prog prog = { 0 };
+    prog.now = time(NULL);
+
+    // Leading operands that do not look like an expression are the start paths
+    int i = 1;
+    while (args[i] != NULL && args[i][0] != '-' && strcmp(args[i], "!") != 0) i ++ ;
+    int first_expr = i;
+
+    if (find_compile(args, first_expr, &prog) != 0)
+    {
+        free(prog.code);
+        ksh_last_status = 1;
+        return 1;
+    }
+
+    struct find_walk walk = { 0 };
+    walk.prog = &prog;
+    walk.ndeques = ksh_pool_threads();
+    walk.deques = calloc(walk.ndeques, sizeof(struct find_deque));
+    if (!walk.deques) ksh_allocate_error();
+    for (int d = 0; d < walk.ndeques; d ++ ) pthread_mutex_init(&walk.deques[d].lock, NULL);
+    pthread_mutex_init(&walk.results_lock, NULL);
+    pthread_mutex_init(&walk.idle_lock, NULL);
+    pthread_cond_init(&walk.idle, NULL);
+
+    // The start paths themselves are tested too, like GNU find
+    char* dot[] = { ".", NULL };
+    char** roots = (first_expr > 1) ? &args[1] : dot;
+    int nroots = (first_expr > 1) ? first_expr - 1 : 1;
+    ksh_last_status = 0;
+    for (int r = 0; r < nroots; r ++ )
+    {
+        struct stat st;
+        if (lstat(roots[r], &st) != 0)
+        {
+            fprintf(stderr, "ksh: find: \'%s\': %s\n", roots[r], strerror(errno));
+            ksh_last_status = 1;
+            continue;
+        }
+        if (find_match(&prog, AT_FDCWD, roots[r], S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN))
+        {
+            char* path = strdup(roots[r]);
+            if (!path) ksh_allocate_error();
+            find_emit(&walk, path);
+        }
+        if (S_ISDIR(st.st_mode))
+        {
+            char* path = strdup(roots[r]);
+            if (!path) ksh_allocate_error();
+            find_push(&walk, 0, path, -1);
+        }
+    }
+
+    ksh_parallel_for(walk.ndeques, find_worker, &walk);
+
+    // Sorted output and -exec see all results at once
+    if (prog.sorted) qsort(walk.results, walk.nresults, sizeof(char*), find_cmp);
+    int status = ksh_last_status;
+    if (prog.exec_argv)
+    {
+        if (find_exec(&prog, walk.results, walk.nresults) != 0) status = 1;
+    }
+    else for (int r = 0; r < walk.nresults; r ++ ) printf("%s%c", walk.results[r], prog.print0 ? '\0' : '\n');
+    fflush(stdout);
+
+    for (int r = 0; r < walk.nresults; r ++ ) free(walk.results[r]);
+    free(walk.results);
+    for (int d = 0; d < walk.ndeques; d ++ )
+    {
+        pthread_mutex_destroy(&walk.deques[d].lock);
+        free(walk.deques[d].items);
+    }
+    pthread_mutex_destroy(&walk.idle_lock);
+    pthread_cond_destroy(&walk.idle);
+    free(walk.deques);
+    free(prog.code);
+    ksh_last_status = status;
+    return 1;
+}
@@ -1,14 +1,20 @@
 #include "launch.h"
 #include "built-in.h"
+#include "affinity.h"
+#include "trace.h"
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <linux/limits.h>
 
 
+int ksh_last_status;
+
 // Print out error when allocation failed
 void ksh_allocate_error()
 {
@@ -79,7 +85,7 @@ char** ksh_split_line(char* line)
     char** tokens = malloc(bufsize * sizeof(char*));    // sizeof char* is 8 bytes
     char* token;
 
-    if (!token) ksh_allocate_error();
+    if (!tokens) ksh_allocate_error();
 
     token = strtok(line, KSH_TOKEN_DELIMTERS);
     // strtok is used to split a string into tokens
@@ -111,7 +117,34 @@ int ksh_launch(char** args)
     // pid is process id, wpid is wait process id
     int status;         
     // status of the process
+    int background = 0;
+    // a trailing "&" runs the command without waiting for it
+    struct ksh_placement placement;
+    // CPUs and NUMA node the command will run on (see affinity.c)
+
+    int argc = 0;
+    while (args[argc] != NULL) argc ++ ;
+    if (argc > 1 && strcmp(args[argc - 1], "&") == 0)
+    {
+        args[argc - 1] = NULL;
+        background = 1;
+    }
+
+    int exec_pipe[2] = { -1, -1 };
+    // only while tracing: a close-on-exec pipe whose write end disappears
+    // the moment execvp succeeds, so the parent can time the exec
+    if (ksh_trace_enabled && pipe(exec_pipe) == 0)
+    {
+        fcntl(exec_pipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(exec_pipe[1], F_SETFD, FD_CLOEXEC);
+    }
 
+    ksh_affinity_place(&placement);
+    fflush(stdout);
+    fflush(stderr);
+    // the child inherits unwritten stdio buffers: flush them first, or a
+    // script's earlier output comes out after the command's, or twice
+    KSH_TRACE_BEGIN(t_fork);
     pid = fork();
     // (1) in parent process, fork() returns the process ID of the child process
     // (2) in child process, fork() returns 0
@@ -120,18 +153,50 @@ int ksh_launch(char** args)
     // fork a child process
     if (pid == 0)
     {
+        if (exec_pipe[0] >= 0) close(exec_pipe[0]);
+        ksh_affinity_apply(&placement);
+        // pin the child before execvp, so the new program starts on its CPUs
         if (execvp(args[0], args) == -1) perror("ksh: excecution failed...");
         // execvp is used to set up a new program in the current process space
         // args[0] is the executable file name, args is the arguments
         // like execvp("ls", ["ls", "-l"]), then search "ls" in PATH ("/bin/ls") and execute it
         // execvp will search for the executable file in the PATH environment variable
         // only need to pass the file name, not the full path
-        exit(EXIT_FAILURE);
+        _exit(EXIT_FAILURE);
+        // _exit skips atexit handlers and stdio flushing, which belong to the shell
+    }
+    else if (pid < 0)
+    {
+        perror("ksh: fork failed...");
+        if (exec_pipe[0] >= 0) { close(exec_pipe[0]); close(exec_pipe[1]); }
+        ksh_last_status = 1;
+        return 1;
+    }
+
+    KSH_TRACE_END(t_fork, "fork", args[0]);
+    if (exec_pipe[0] >= 0)
+    {
+        char c;
+        KSH_TRACE_BEGIN(t_exec);
+        close(exec_pipe[1]);
+        while (read(exec_pipe[0], &c, 1) < 0 && errno == EINTR);
+        // read returns 0 (EOF) once the child has exec'ed or exited
+        close(exec_pipe[0]);
+        KSH_TRACE_END(t_exec, "exec", args[0]);
+    }
+
+    if (background)
+    {
+        ksh_affinity_track(pid, &placement);
+        printf("[%d]\n", pid);
+        // reaped later by ksh_reap_jobs
+        ksh_last_status = 0;
     }
-    else if (pid < 0) perror("ksh: fork failed...");
     else  
     // pid is the process id of the child process
     {
+        ksh_affinity_track(pid, &placement);
+        KSH_TRACE_BEGIN(t_wait);
         do {
             wpid = waitpid(pid, &status, WUNTRACED);
             // waitpid is used to wait for a child process to change state
@@ -144,6 +209,10 @@ int ksh_launch(char** args)
         // !(((signed char) (((status) & 0x7f) + 1) >> 1) > 0)
         // (1) when the child process has exited normally, WIFEXITED(status) is true
         // (2) when the child process has exited due to a signal, WIFSIGNALED(status) is true
+        KSH_TRACE_END(t_wait, "wait", args[0]);
+        ksh_last_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        // like other shells, a command killed by signal N reports 128 + N
+        ksh_affinity_release(pid);
     }
 
     return 1;
@@ -154,15 +223,35 @@ int ksh_execute(char** args)
 {
     // User typed in nothing, return 1 and continue
     if (args[0] == NULL) return 1;
+    KSH_TRACE_BEGIN(t_dispatch);
     for (int i = 0; i < ksh_num_builtins(); i ++ )
         if (strcmp(args[0], builtin_str[i]) == 0)
-            return (*builtin_func[i])(args);
-            // call the built-in function by passing the arguments
+        {
+            int status = (*builtin_func[i])(args);
+            // call the built-in function by passing the arguments,
+            // it leaves its own exit status in ksh_last_status
+            KSH_TRACE_END(t_dispatch, "builtin", args[0]);
+            return status;
+        }
+    KSH_TRACE_END(t_dispatch, "dispatch", args[0]);
     
     // If the command is not a built-in command, execute it with ksh_launch method
     return ksh_launch(args);
 }
 
+// 5. Collect background commands that have finished, without blocking
+void ksh_reap_jobs(void)
+{
+    pid_t pid;
+    int status;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    // WNOHANG makes waitpid return 0 instead of waiting when no child has exited yet
+    {
+        ksh_affinity_release(pid);
+        printf("[%d] done\n", pid);
+    }
+}
+
 // 6. Main loop of the shell
 void ksh_loop(void)
 {
@@ -173,6 +262,7 @@ void ksh_loop(void)
     char* username = getenv("USER");    // get the username from the environment variable
 
     do {
+        ksh_reap_jobs();
         if (getcwd(cwd, sizeof(cwd)) != NULL) 
         {
             if (username != NULL) printf("\033[35m%s\033[0m in \033[32m%s\033[0m \033[33mλ\033[0m ", username, cwd);
@@ -180,8 +270,12 @@ void ksh_loop(void)
         }
         else perror("ksh: getcwd failed...\n");
 
+        KSH_TRACE_BEGIN(t_read);
         line = ksh_read_line();
+        KSH_TRACE_END(t_read, "read", NULL);
+        KSH_TRACE_BEGIN(t_split);
         args = ksh_split_line(line);
+        KSH_TRACE_END(t_split, "split", args[0]);
         status = ksh_execute(args);
         // (1) read a line from standard input
         // (2) split the line into tokens
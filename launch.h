@@ -6,10 +6,14 @@
 #define KSH_TOKEN_DELIMTERS " \t\r\n\a"
 // like ' ', '\t', '\r', '\n', '\a' are delimiters (分界符)
 
+// Exit status of the last command, 0 for success (what scripts call $?)
+extern int ksh_last_status;
+
 // Function declarations for shell lauching
 extern void ksh_allocate_error();
 extern char* ksh_read_line(void);
 extern char** ksh_split_line(char* line);
 extern int ksh_launch(char** args);
 extern int ksh_execute(char** args);
+extern void ksh_reap_jobs(void);
 extern void ksh_loop(void);
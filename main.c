@@ -7,11 +7,27 @@
 #include <linux/limits.h>
 #include "built-in.h"
 #include "launch.h"
+#include "trace.h"
+#include "script.h"
+#include "trash.h"
 
 // Main function
 int main(int argc, char** argv)
 {
+    // Turn on tracing if KSH_TRACE names an output file
+    ksh_trace_init();
+
+    // Resume deleting whatever an earlier shell left in the trash
+    ksh_trash_init();
+
+    // ksh script [args...] runs the script instead of the interactive loop
+    if (argc > 1)
+    {
+        ksh_run_script(argv[1], argc - 1, argv + 1);
+        return ksh_last_status;
+    }
+
     // Start the shell loop
     ksh_loop();
-    return EXIT_SUCCESS;
+    return ksh_last_status;
 }
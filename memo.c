@@ -0,0 +1,426 @@
+#include "built-in.h"
+#include "launch.h"
+#include "checksum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <linux/limits.h>
+
+// memo [-e NAME]... [-i FILE]... command [args...]
+// memo --stats | --clear
+//
+// Runs a deterministic command once and replays its stdout, stderr and
+// exit status afterwards. Only runs that exit with status 0 are kept: a
+// failure may well be transient and is never replayed. The cache key is
+// the SHA-256 of the argv, the working directory, the named environment
+// variables and the (inode, size, mtime) of every -i input file, so
+// touching an input invalidates the entry without reading its contents.
+//
+// Entries live in $KSH_MEMO_DIR (default ~/.cache/ksh/memo), one file per
+// key. Replaying an entry bumps its mtime, and when the store grows past
+// $KSH_MEMO_SIZE bytes (default 256 MB) the least recently used entries
+// are removed.
+
+#define MEMO_MAGIC 0x4f4d454d48534bULL     // "KSHMEMO"
+#define MEMO_DEFAULT_SIZE (256ll << 20)
+
+// Header at the start of every entry, followed by the stdout then stderr bytes
+struct memo_header {
+    uint64_t magic;
+    int64_t status;         // wait status of the original run
+    int64_t out_len;
+    int64_t err_len;
+};
+
+// Hit/miss counters kept in the store, shared by every shell using it
+struct memo_stats {
+    int64_t hits, misses;
+};
+
+static long long memo_size_cap(void)
+{
+    const char* env = getenv("KSH_MEMO_SIZE");
+    long long cap = env ? atoll(env) : 0;
+    return cap > 0 ? cap : MEMO_DEFAULT_SIZE;
+}
+
+// Add one field to the key, NUL-terminated so "ab" "c" differs from "a" "bc"
+static void memo_key_add(ksh_hash_ctx* ctx, const void* data, size_t len)
+{
+    ksh_hash_update(ctx, data, len);
+    ksh_hash_update(ctx, "", 1);
+}
+
+// Update the persistent hit/miss counters, or just read them when both deltas are 0
+static struct memo_stats memo_count(const char* dir, int hit, int miss)
+{
+    struct memo_stats st = { 0, 0 };
+    char path[PATH_MAX];
+    if (ksh_path(path, "%s/stats", dir) != 0) return st;
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) return st;
+
+    flock(fd, LOCK_EX);
+    // another shell may be updating the same counters
+    if (pread(fd, &st, sizeof(st), 0) != sizeof(st)) memset(&st, 0, sizeof(st));
+    st.hits += hit;
+    st.misses += miss;
+    if (hit || miss) pwrite(fd, &st, sizeof(st), 0);
+    flock(fd, LOCK_UN);
+    close(fd);
+    return st;
+}
+
+// Copy len bytes from an entry or a capture file to an output fd
+// (read/write rather than sendfile: the terminal or file may be O_APPEND)
+static void memo_copy_out(int from, off_t offset, int64_t len, int to)
+{
+    char buf[64 * 1024];
+    while (len > 0)
+    {
+        ssize_t n = pread(from, buf, len < (int64_t) sizeof(buf) ? len : (int64_t) sizeof(buf), offset);
+        if (n <= 0) break;
+        for (ssize_t done = 0; done < n; )
+        {
+            ssize_t w = write(to, buf + done, n - done);
+            if (w <= 0) return;
+            done += w;
+        }
+        offset += n;
+        len -= n;
+    }
+}
+
+// Make the wait status of the run (recorded or fresh) the shell's $?
+static void memo_report(int64_t status)
+{
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+        fprintf(stderr, "ksh: memo: exited with status %" PRId64 "\n", WEXITSTATUS(status));
+    else if (WIFSIGNALED(status))
+        fprintf(stderr, "ksh: memo: killed by signal %" PRId64 "\n", WTERMSIG(status));
+    ksh_last_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static int memo_replay(const char* entry)
+{
+    struct memo_header h;
+    int fd = open(entry, O_RDONLY);
+    if (fd < 0) return -1;
+    if (pread(fd, &h, sizeof(h), 0) != sizeof(h) || h.magic != MEMO_MAGIC)
+    {
+        close(fd);
+        return -1;
+    }
+
+    fflush(stdout);
+    memo_copy_out(fd, sizeof(h), h.out_len, STDOUT_FILENO);
+    memo_copy_out(fd, sizeof(h) + h.out_len, h.err_len, STDERR_FILENO);
+    futimens(fd, NULL);     // mark as most recently used
+    close(fd);
+    memo_report(h.status);
+    return 0;
+}
+
+// Child side of a miss: run the command with stdout/stderr going to the entry
+static void memo_run_child(char** args, int out_fd, int err_fd)
+{
+    dup2(out_fd, STDOUT_FILENO);
+    dup2(err_fd, STDERR_FILENO);
+
+    // Built-ins run right here in the child, so 'memo ls -l' works too
+    for (int i = 0; i < ksh_num_builtins(); i ++ )
+        if (strcmp(args[0], builtin_str[i]) == 0)
+        {
+            (*builtin_func[i])(args);
+            fflush(stdout);
+            fflush(stderr);
+            _exit(ksh_last_status);
+        }
+
+    execvp(args[0], args);
+    perror("ksh: excecution failed...");
+    _exit(EXIT_FAILURE);
+}
+
+// Append the contents of 'from' to 'to'
+static int64_t memo_append(int to, int from)
+{
+    struct stat st;
+    if (fstat(from, &st) != 0) return 0;
+    off_t offset = 0;
+    int64_t left = st.st_size;
+    while (left > 0)
+    {
+        ssize_t n = sendfile(to, from, &offset, left);
+        if (n <= 0) break;
+        left -= n;
+    }
+    return st.st_size - left;
+}
+
+// Run the command, store what it printed if it succeeded, then replay it
+// like a hit; a failed run, or one that could not be stored, is shown
+// straight from the capture files
+static int memo_record(char** args, const char* dir, const char* entry)
+{
+    char out_path[PATH_MAX], err_path[PATH_MAX], tmp_path[PATH_MAX];
+    if (ksh_path(out_path, "%s/.out.%d", dir, (int) getpid()) != 0 ||
+        ksh_path(err_path, "%s/.err.%d", dir, (int) getpid()) != 0 ||
+        ksh_path(tmp_path, "%s/.new.%d", dir, (int) getpid()) != 0)
+    {
+        perror("ksh: memo: cannot name the capture files...");
+        return -1;
+    }
+
+    int out_fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    int err_fd = open(err_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (out_fd < 0 || err_fd < 0)
+    {
+        perror("ksh: memo: open failed...");
+        if (out_fd >= 0) close(out_fd);
+        if (err_fd >= 0) close(err_fd);
+        return -1;
+    }
+    unlink(out_path);
+    unlink(err_path);
+    // the capture files are anonymous from here on and vanish when closed
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) memo_run_child(args, out_fd, err_fd);
+    if (pid < 0)
+    {
+        perror("ksh: fork failed...");
+        close(out_fd);
+        close(err_fd);
+        return -1;
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+
+    // Header, stdout, stderr; written under a temporary name and renamed
+    // into place, so a reader never sees a half-written entry
+    int stored = 0;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    {
+        struct memo_header h = { MEMO_MAGIC, status, 0, 0 };
+        int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd >= 0)
+        {
+            lseek(fd, sizeof(h), SEEK_SET);
+            h.out_len = memo_append(fd, out_fd);
+            h.err_len = memo_append(fd, err_fd);
+            int ok = pwrite(fd, &h, sizeof(h), 0) == sizeof(h);
+            if (close(fd) != 0 || !ok || rename(tmp_path, entry) != 0)
+            {
+                perror("ksh: memo: cannot store result...");
+                unlink(tmp_path);
+            }
+            else stored = 1;
+        }
+        else perror("ksh: memo: cannot store result...");
+    }
+
+    int r = stored ? memo_replay(entry) : -1;
+    if (r != 0)
+    {
+        // the entry is not there (or vanished already): the capture files still are
+        struct stat st;
+        fflush(stdout);
+        if (fstat(out_fd, &st) == 0) memo_copy_out(out_fd, 0, st.st_size, STDOUT_FILENO);
+        if (fstat(err_fd, &st) == 0) memo_copy_out(err_fd, 0, st.st_size, STDERR_FILENO);
+        memo_report(status);
+    }
+    close(out_fd);
+    close(err_fd);
+    return 0;
+}
+
+// Drop least recently used entries until the store fits under the size cap
+struct memo_entry {
+    char name[80];
+    off_t size;
+    struct timespec used;
+};
+
+static int memo_lru_cmp(const void* a, const void* b)
+{
+    const struct memo_entry* x = a;
+    const struct memo_entry* y = b;
+    if (x->used.tv_sec != y->used.tv_sec) return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    if (x->used.tv_nsec != y->used.tv_nsec) return x->used.tv_nsec < y->used.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+// Collect the entries of the store, returns how many
+static int memo_scan(const char* dir, struct memo_entry** out, long long* total)
+{
+    DIR* d = opendir(dir);
+    struct dirent* de;
+    int n = 0, cap = 0;
+    *out = NULL;
+    *total = 0;
+    if (!d) return 0;
+
+    while ((de = readdir(d)) != NULL)
+    {
+        struct stat st;
+        // entries are named by their 64-digit hex key; skip stats and temporaries
+        if (strlen(de->d_name) != 64 || fstatat(dirfd(d), de->d_name, &st, 0) != 0) continue;
+        if (n == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            *out = realloc(*out, sizeof(struct memo_entry) * cap);
+            if (!*out) ksh_allocate_error();
+        }
+        snprintf((*out)[n].name, sizeof((*out)[n].name), "%s", de->d_name);
+        (*out)[n].size = st.st_size;
+        (*out)[n ++ ].used = st.st_mtim;
+        *total += st.st_size;
+    }
+    closedir(d);
+    return n;
+}
+
+static void memo_evict(const char* dir)
+{
+    struct memo_entry* entries;
+    long long total, cap = memo_size_cap();
+    int n = memo_scan(dir, &entries, &total);
+
+    if (total > cap)
+    {
+        qsort(entries, n, sizeof(struct memo_entry), memo_lru_cmp);
+        for (int i = 0; i < n && total > cap; i ++ )
+        {
+            char path[PATH_MAX];
+            if (ksh_path(path, "%s/%s", dir, entries[i].name) == 0 && unlink(path) == 0) total -= entries[i].size;
+        }
+    }
+    free(entries);
+}
+
+static void memo_print_stats(const char* dir)
+{
+    struct memo_entry* entries;
+    long long total;
+    int n = memo_scan(dir, &entries, &total);
+    struct memo_stats st = memo_count(dir, 0, 0);
+    long long lookups = st.hits + st.misses;
+
+    printf("store:    %s\n", dir);
+    printf("entries:  %d (%lld of %lld bytes)\n", n, total, memo_size_cap());
+    printf("hits:     %lld\n", (long long) st.hits);
+    printf("misses:   %lld\n", (long long) st.misses);
+    printf("hit rate: %.1f%%\n", lookups ? 100.0 * st.hits / lookups : 0.0);
+    free(entries);
+}
+
+int ksh_memo(char** args)
+{
+    char dir[PATH_MAX];
+    ksh_last_status = 0;
+    if (ksh_cache_dir("KSH_MEMO_DIR", "memo", dir) != 0)
+    {
+        perror("ksh: memo: cannot create the store...");
+        ksh_last_status = 1;
+        return 1;
+    }
+
+    if (args[1] != NULL && strcmp(args[1], "--stats") == 0)
+    {
+        memo_print_stats(dir);
+        return 1;
+    }
+    if (args[1] != NULL && strcmp(args[1], "--clear") == 0)
+    {
+        struct memo_entry* entries;
+        long long total;
+        int n = memo_scan(dir, &entries, &total);
+        for (int i = 0; i < n; i ++ )
+        {
+            char path[PATH_MAX];
+            if (ksh_path(path, "%s/%s", dir, entries[i].name) == 0) unlink(path);
+        }
+        char stats[PATH_MAX];
+        if (ksh_path(stats, "%s/stats", dir) == 0) unlink(stats);
+        free(entries);
+        return 1;
+    }
+
+    // Build the key while parsing the options
+    ksh_hash_ctx key;
+    ksh_hash_init(&key, KSH_HASH_SHA256);
+    int i = 1;
+    while (args[i] != NULL && args[i + 1] != NULL && (strcmp(args[i], "-e") == 0 || strcmp(args[i], "-i") == 0))
+    {
+        const char* name = args[i + 1];
+        if (args[i][1] == 'e')
+        {
+            const char* value = getenv(name);
+            memo_key_add(&key, "env", 3);
+            memo_key_add(&key, name, strlen(name));
+            // an unset variable is keyed differently from an empty one
+            if (value) memo_key_add(&key, value, strlen(value));
+        }
+        else
+        {
+            struct stat st;
+            memo_key_add(&key, "input", 5);
+            memo_key_add(&key, name, strlen(name));
+            if (stat(name, &st) == 0)
+            {
+                int64_t id[5] = { st.st_dev, st.st_ino, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+                memo_key_add(&key, id, sizeof(id));
+            }
+        }
+        i += 2;
+    }
+    if (args[i] != NULL && strcmp(args[i], "--") == 0) i ++ ;
+    if (args[i] == NULL)
+    {
+        fprintf(stderr, "Usage: memo [-e NAME]... [-i FILE]... command [args...] | --stats | --clear\n");
+        ksh_last_status = 2;
+        return 1;
+    }
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) cwd[0] = '\0';
+    memo_key_add(&key, "cwd", 3);
+    memo_key_add(&key, cwd, strlen(cwd));
+    memo_key_add(&key, "argv", 4);
+    for (int a = i; args[a] != NULL; a ++ ) memo_key_add(&key, args[a], strlen(args[a]));
+
+    char hex[KSH_HASH_MAX_HEX], entry[PATH_MAX];
+    ksh_hash_final(&key, hex);
+    if (ksh_path(entry, "%s/%s", dir, hex) != 0)
+    {
+        perror("ksh: memo: cannot name the entry...");
+        ksh_last_status = 1;
+        return 1;
+    }
+
+    if (memo_replay(entry) == 0)
+    {
+        memo_count(dir, 1, 0);
+        return 1;
+    }
+
+    memo_count(dir, 0, 1);
+    if (memo_record(&args[i], dir, entry) != 0) ksh_last_status = 1;
+    memo_evict(dir);
+    return 1;
+}
@@ -0,0 +1,59 @@
+#include "pool.h"
+#include "trace.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// Shared state of one ksh_parallel_for call
+struct ksh_pool_job {
+    int n;                      // number of items
+    int next;                   // next item to hand out, updated atomically
+    void (*fn)(int, void*);     // work function
+    void* arg;                  // argument passed through to fn
+};
+
+int ksh_pool_threads(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    // sysconf returns the number of processors currently online
+    return cpus > 0 ? (int) cpus : 1;
+}
+
+// Every worker keeps taking the next unclaimed index until none are left,
+// so a slow item never holds up the others
+static void* ksh_pool_worker(void* p)
+{
+    struct ksh_pool_job* job = p;
+    int i;
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->n)
+    {
+        KSH_TRACE_BEGIN(t_item);
+        job->fn(i, job->arg);
+        KSH_TRACE_END(t_item, "pool item", NULL);
+    }
+    return NULL;
+}
+
+void ksh_parallel_for(int n, void (*fn)(int, void*), void* arg)
+{
+    struct ksh_pool_job job = { n, 0, fn, arg };
+    int nthreads = ksh_pool_threads();
+    if (nthreads > n) nthreads = n;
+
+    // The calling thread works too, so only (nthreads - 1) extra threads are spawned
+    pthread_t* tids = NULL;
+    int started = 0;
+    if (nthreads > 1)
+    {
+        tids = malloc(sizeof(pthread_t) * (nthreads - 1));
+        if (tids)
+            while (started < nthreads - 1 && pthread_create(&tids[started], NULL, ksh_pool_worker, &job) == 0)
+                started ++ ;
+        // if thread creation fails, the remaining work is simply done by fewer threads
+    }
+
+    ksh_pool_worker(&job);
+
+    for (int t = 0; t < started; t ++ ) pthread_join(tids[t], NULL);
+    free(tids);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+// Function declarations for the worker thread pool
+// used by built-in commands that process many independent items
+
+// Number of worker threads to use (one per online CPU)
+int ksh_pool_threads(void);
+
+// Call fn(i, arg) for every i in [0, n), spread over the worker threads.
+// Returns when all n items are done.
+void ksh_parallel_for(int n, void (*fn)(int, void*), void* arg);
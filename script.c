@@ -0,0 +1,1221 @@
+#include "script.h"
+#include "built-in.h"
+#include "launch.h"
+#include "checksum.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <setjmp.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <linux/limits.h>
+
+// Scripts are read once, parsed into an AST and lowered to the bytecode in
+// script.h, which then runs in-process: loops, conditionals and function
+// calls never re-read or re-split a line. The bytecode is also saved in
+// ~/.cache/ksh/bytecode (or $KSH_BYTECODE_DIR) under a key made from the
+// script's contents and mtime, so the next run of an unchanged script
+// skips the parser entirely.
+//
+// The language is a small subset of sh:
+//     NAME=value   $NAME ${NAME} $1..$9 $# $? $@ $* $$   '...' "..." \c   # comments
+//     if LIST; then LIST; [elif LIST; then LIST;] [else LIST;] fi
+//     while LIST; do LIST; done
+//     for NAME [in WORDS]; do LIST; done      break  continue
+//     NAME() { LIST; }                        return [N]   exit [N]
+// Variables are environment variables, so commands see them as well.
+
+#define KSH_BC_MAGIC 0x4f4c4f434853424bULL
+#define KSH_BC_VERSION 2
+
+#define GROW(arr, n, cap) \
+    do { \
+        if ((n) == (cap)) \
+        { \
+            (cap) = (cap) ? (cap) * 2 : 64; \
+            (arr) = realloc((arr), sizeof(*(arr)) * (cap)); \
+            if (!(arr)) ksh_allocate_error(); \
+        } \
+    } while (0)
+
+// 1. Program builder
+struct builder {
+    struct ksh_program prog;
+    int code_cap, segs_cap, words_cap, lists_cap, strings_cap;
+};
+
+static int add_string(struct builder* b, const char* s, size_t n)
+{
+    while (b->prog.nstrings + (int) n + 1 > b->strings_cap)
+    {
+        b->strings_cap = b->strings_cap ? b->strings_cap * 2 : 1024;
+        b->prog.strings = realloc(b->prog.strings, b->strings_cap);
+        if (!b->prog.strings) ksh_allocate_error();
+    }
+    int off = b->prog.nstrings;
+    memcpy(b->prog.strings + off, s, n);
+    b->prog.strings[off + n] = '\0';
+    b->prog.nstrings += n + 1;
+    return off;
+}
+
+static void add_seg(struct builder* b, struct ksh_seg seg)
+{
+    GROW(b->prog.segs, b->prog.nsegs, b->segs_cap);
+    b->prog.segs[b->prog.nsegs ++ ] = seg;
+}
+
+static int add_list(struct builder* b, const int* words, int n)
+{
+    int start = b->prog.nlists;
+    for (int i = 0; i < n; i ++ )
+    {
+        GROW(b->prog.lists, b->prog.nlists, b->lists_cap);
+        b->prog.lists[b->prog.nlists ++ ] = words[i];
+    }
+    return start;
+}
+
+static int emit(struct builder* b, int op, int a, int bb)
+{
+    GROW(b->prog.code, b->prog.ncode, b->code_cap);
+    b->prog.code[b->prog.ncode] = (struct ksh_insn) { op, a, bb };
+    return b->prog.ncode ++ ;
+}
+
+// 2. Lexer: turns the whole script into tokens; words are split into
+//    literal and variable segments here, once
+enum tok_type { T_WORD, T_SEMI, T_NL, T_LPAREN, T_RPAREN, T_EOF };
+
+struct token {
+    int type;
+    int word;       // T_WORD: index into prog.words
+    int line;
+};
+
+struct node;
+
+struct parser {
+    struct builder* b;
+    const char* path;
+    struct token* toks;
+    int ntoks, toks_cap, pos;
+    char* buf;                  // literal text of the segment being lexed
+    size_t blen, bcap;
+    int line;
+    void** allocs;              // every AST allocation, freed after compiling
+    int nallocs, allocs_cap;
+    struct loop_ctx* loop;      // innermost loop while compiling
+    jmp_buf fail;
+};
+
+static void syntax_error(struct parser* p, int line, const char* msg)
+{
+    fprintf(stderr, "ksh: %s:%d: %s\n", p->path, line, msg);
+    longjmp(p->fail, 1);
+}
+
+static void buf_add(struct parser* p, char c)
+{
+    if (p->blen + 1 >= p->bcap)
+    {
+        p->bcap = p->bcap ? p->bcap * 2 : 256;
+        p->buf = realloc(p->buf, p->bcap);
+        if (!p->buf) ksh_allocate_error();
+    }
+    p->buf[p->blen ++ ] = c;
+}
+
+static void flush_literal(struct parser* p)
+{
+    if (p->blen == 0) return;
+    add_seg(p->b, (struct ksh_seg) { add_string(p->b, p->buf, p->blen), KSH_SEG_LIT });
+    p->blen = 0;
+}
+
+static void push_token(struct parser* p, int type, int word)
+{
+    GROW(p->toks, p->ntoks, p->toks_cap);
+    p->toks[p->ntoks ++ ] = (struct token) { type, word, p->line };
+}
+
+// src[*i] is '$'; add a variable segment and return 1, or return 0 for a literal '$'
+static int lex_var(struct parser* p, const char* src, size_t len, size_t* i, int flags)
+{
+    size_t start = *i + 1, end;
+    if (start < len && src[start] == '{')
+    {
+        end = start + 1;
+        while (end < len && src[end] != '}') end ++ ;
+        if (end >= len) syntax_error(p, p->line, "missing '}'");
+        flush_literal(p);
+        add_seg(p->b, (struct ksh_seg) { add_string(p->b, src + start + 1, end - start - 1), KSH_SEG_VAR | flags });
+        *i = end + 1;
+        return 1;
+    }
+    if (start < len && (src[start] == '_' || isalpha((unsigned char) src[start])))
+    {
+        end = start;
+        while (end < len && (src[end] == '_' || isalnum((unsigned char) src[end]))) end ++ ;
+    }
+    else if (start < len && src[start] != '\0' && strchr("0123456789#?@*$", src[start])) end = start + 1;
+    else return 0;
+
+    flush_literal(p);
+    add_seg(p->b, (struct ksh_seg) { add_string(p->b, src + start, end - start), KSH_SEG_VAR | flags });
+    *i = end;
+    return 1;
+}
+
+static void lex_word(struct parser* p, const char* src, size_t len, size_t* pi)
+{
+    struct builder* b = p->b;
+    size_t i = *pi;
+    GROW(b->prog.words, b->prog.nwords, b->words_cap);
+    int w = b->prog.nwords ++ ;
+    int seg_start = b->prog.nsegs, quoted = 0;
+    p->blen = 0;
+
+    while (i < len && !strchr(" \t\r\n;&()", src[i]))
+    {
+        char c = src[i];
+        if (c == '\\')
+        {
+            // backslash-newline joins lines, any other backslash quotes the next character
+            if (i + 1 < len && src[i + 1] == '\n') p->line ++ ;
+            else if (i + 1 < len) buf_add(p, src[i + 1]);
+            i += 2;
+        }
+        else if (c == '\'')
+        {
+            quoted = 1;
+            for (i ++ ; i < len && src[i] != '\''; i ++ )
+            {
+                if (src[i] == '\n') p->line ++ ;
+                buf_add(p, src[i]);
+            }
+            if (i >= len) syntax_error(p, p->line, "unterminated single quote");
+            i ++ ;
+        }
+        else if (c == '"')
+        {
+            quoted = 1;
+            for (i ++ ; i < len && src[i] != '"'; )
+            {
+                if (src[i] == '\\' && i + 1 < len && strchr("$\"\\`\n", src[i + 1]))
+                {
+                    if (src[i + 1] == '\n') p->line ++ ;
+                    else buf_add(p, src[i + 1]);
+                    i += 2;
+                }
+                else if (src[i] == '$' && lex_var(p, src, len, &i, KSH_SEG_QUOTED)) continue;
+                else
+                {
+                    if (src[i] == '\n') p->line ++ ;
+                    buf_add(p, src[i ++ ]);
+                }
+            }
+            if (i >= len) syntax_error(p, p->line, "unterminated double quote");
+            i ++ ;
+        }
+        else if (c == '$' && lex_var(p, src, len, &i, 0)) continue;
+        else buf_add(p, src[i ++ ]);
+    }
+    flush_literal(p);
+
+    // '' or "" is still one (empty) argument
+    if (b->prog.nsegs == seg_start && quoted) add_seg(b, (struct ksh_seg) { add_string(b, "", 0), KSH_SEG_LIT });
+    b->prog.words[w] = (struct ksh_word) { seg_start, b->prog.nsegs - seg_start, quoted };
+    push_token(p, T_WORD, w);
+    *pi = i;
+}
+
+static void lex(struct parser* p, const char* src, size_t len)
+{
+    size_t i = 0;
+    p->line = 1;
+    while (1)
+    {
+        while (i < len && (src[i] == ' ' || src[i] == '\t' || src[i] == '\r')) i ++ ;
+        if (i + 1 < len && src[i] == '\\' && src[i + 1] == '\n')
+        {
+            i += 2;
+            p->line ++ ;
+            continue;
+        }
+        if (i >= len) break;
+
+        char c = src[i];
+        if (c == '#') while (i < len && src[i] != '\n') i ++ ;
+        else if (c == '\n') { push_token(p, T_NL, -1); p->line ++ ; i ++ ; }
+        else if (c == ';') { push_token(p, T_SEMI, -1); i ++ ; }
+        else if (c == '(') { push_token(p, T_LPAREN, -1); i ++ ; }
+        else if (c == ')') { push_token(p, T_RPAREN, -1); i ++ ; }
+        else if (c == '&')
+        {
+            // '&' is passed on as its own argument, ksh_launch runs the command in the background
+            struct builder* b = p->b;
+            GROW(b->prog.words, b->prog.nwords, b->words_cap);
+            add_seg(b, (struct ksh_seg) { add_string(b, "&", 1), KSH_SEG_LIT });
+            b->prog.words[b->prog.nwords] = (struct ksh_word) { b->prog.nsegs - 1, 1, 0 };
+            push_token(p, T_WORD, b->prog.nwords ++ );
+            i ++ ;
+        }
+        else lex_word(p, src, len, &i);
+    }
+    push_token(p, T_EOF, -1);
+}
+
+// 3. Parser: recursive descent over the tokens, builds the AST
+enum node_type { N_CMD, N_IF, N_WHILE, N_FOR, N_FUNC, N_GROUP };
+
+struct node {
+    int type;
+    int line;
+    int* words;             // N_CMD arguments, N_FOR 'in' list
+    int nwords;
+    int* assigns;           // N_CMD leading NAME=value words
+    int nassigns;
+    int name;               // N_FOR variable or N_FUNC name (word index)
+    int implicit_list;      // N_FOR without 'in' loops over "$@"
+    struct node* cond;      // N_IF, N_WHILE
+    struct node* body;      // N_IF then-part, loops, functions, groups
+    struct node* orelse;    // N_IF else-part (another N_IF for elif)
+    struct node* next;      // next command of the same list
+};
+
+static void* p_alloc(struct parser* p, size_t size)
+{
+    void* mem = calloc(1, size ? size : 1);
+    if (!mem) ksh_allocate_error();
+    GROW(p->allocs, p->nallocs, p->allocs_cap);
+    p->allocs[p->nallocs ++ ] = mem;
+    return mem;
+}
+
+static struct token* peek(struct parser* p) { return &p->toks[p->pos]; }
+
+// A keyword is an unquoted word made of a single literal
+static const char* plain_word(struct parser* p, struct token* t)
+{
+    if (t->type != T_WORD) return NULL;
+    struct ksh_word* w = &p->b->prog.words[t->word];
+    if (w->nsegs != 1 || w->quoted || p->b->prog.segs[w->seg].flags != KSH_SEG_LIT) return NULL;
+    return p->b->prog.strings + p->b->prog.segs[w->seg].str;
+}
+
+static int at_keyword(struct parser* p, const char* kw)
+{
+    const char* s = plain_word(p, peek(p));
+    return s && strcmp(s, kw) == 0;
+}
+
+static void expect_keyword(struct parser* p, const char* kw)
+{
+    if (!at_keyword(p, kw))
+    {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "syntax error: expected '%s'", kw);
+        syntax_error(p, peek(p)->line, msg);
+    }
+    p->pos ++ ;
+}
+
+static void skip_separators(struct parser* p)
+{
+    while (peek(p)->type == T_NL || peek(p)->type == T_SEMI) p->pos ++ ;
+}
+
+static int at_list_end(struct parser* p)
+{
+    static const char* enders[] = { "then", "elif", "else", "fi", "do", "done", "}", NULL };
+    if (peek(p)->type == T_EOF || peek(p)->type == T_RPAREN) return 1;
+    for (int k = 0; enders[k]; k ++ ) if (at_keyword(p, enders[k])) return 1;
+    return 0;
+}
+
+static struct node* parse_command(struct parser* p);
+
+static struct node* parse_list(struct parser* p)
+{
+    struct node *head = NULL, **tail = &head;
+    skip_separators(p);
+    while (!at_list_end(p))
+    {
+        *tail = parse_command(p);
+        tail = &(*tail)->next;
+        if (!at_list_end(p) && peek(p)->type != T_NL && peek(p)->type != T_SEMI)
+            syntax_error(p, peek(p)->line, "syntax error: expected ';' or newline");
+        skip_separators(p);
+    }
+    return head;
+}
+
+// Copy a growing array of word indices into the AST arena
+static int* collect(struct parser* p, const int* tmp, int n)
+{
+    int* out = p_alloc(p, sizeof(int) * n);
+    memcpy(out, tmp, sizeof(int) * n);
+    return out;
+}
+
+static int is_assignment(struct parser* p, int w)
+{
+    struct ksh_word* word = &p->b->prog.words[w];
+    if (word->nsegs == 0 || p->b->prog.segs[word->seg].flags != KSH_SEG_LIT) return 0;
+    const char* s = p->b->prog.strings + p->b->prog.segs[word->seg].str;
+    if (!(*s == '_' || isalpha((unsigned char) *s))) return 0;
+    while (*s == '_' || isalnum((unsigned char) *s)) s ++ ;
+    return *s == '=';
+}
+
+static struct node* parse_simple(struct parser* p)
+{
+    struct node* n = p_alloc(p, sizeof(struct node));
+    int *words = NULL, *assigns = NULL;
+    int nwords = 0, nassigns = 0, words_cap = 0, assigns_cap = 0;
+    n->type = N_CMD;
+    n->line = peek(p)->line;
+
+    while (peek(p)->type == T_WORD)
+    {
+        int w = p->toks[p->pos ++ ].word;
+        if (nwords == 0 && is_assignment(p, w))
+        {
+            GROW(assigns, nassigns, assigns_cap);
+            assigns[nassigns ++ ] = w;
+        }
+        else
+        {
+            GROW(words, nwords, words_cap);
+            words[nwords ++ ] = w;
+        }
+    }
+    if (nwords == 0 && nassigns == 0) syntax_error(p, n->line, "syntax error: expected a command");
+
+    n->words = collect(p, words, nwords);
+    n->nwords = nwords;
+    n->assigns = collect(p, assigns, nassigns);
+    n->nassigns = nassigns;
+    free(words);
+    free(assigns);
+    return n;
+}
+
+// After 'if' or 'elif': condition, then-part and an optional elif/else chain
+static struct node* parse_if_rest(struct parser* p, int line)
+{
+    struct node* n = p_alloc(p, sizeof(struct node));
+    n->type = N_IF;
+    n->line = line;
+    n->cond = parse_list(p);
+    expect_keyword(p, "then");
+    n->body = parse_list(p);
+    if (at_keyword(p, "elif"))
+    {
+        int elif_line = peek(p)->line;
+        p->pos ++ ;
+        n->orelse = parse_if_rest(p, elif_line);
+    }
+    else if (at_keyword(p, "else"))
+    {
+        p->pos ++ ;
+        n->orelse = parse_list(p);
+    }
+    return n;
+}
+
+static struct node* parse_command(struct parser* p)
+{
+    int line = peek(p)->line;
+    struct node* n;
+
+    if (at_keyword(p, "if"))
+    {
+        p->pos ++ ;
+        n = parse_if_rest(p, line);
+        expect_keyword(p, "fi");
+        return n;
+    }
+
+    if (at_keyword(p, "while"))
+    {
+        p->pos ++ ;
+        n = p_alloc(p, sizeof(struct node));
+        n->type = N_WHILE;
+        n->line = line;
+        n->cond = parse_list(p);
+        expect_keyword(p, "do");
+        n->body = parse_list(p);
+        expect_keyword(p, "done");
+        return n;
+    }
+
+    if (at_keyword(p, "for"))
+    {
+        p->pos ++ ;
+        n = p_alloc(p, sizeof(struct node));
+        n->type = N_FOR;
+        n->line = line;
+        if (plain_word(p, peek(p)) == NULL) syntax_error(p, line, "syntax error: expected a name after 'for'");
+        n->name = p->toks[p->pos ++ ].word;
+        while (peek(p)->type == T_NL) p->pos ++ ;
+
+        if (at_keyword(p, "in"))
+        {
+            int *words = NULL, nwords = 0, cap = 0;
+            p->pos ++ ;
+            while (peek(p)->type == T_WORD)
+            {
+                GROW(words, nwords, cap);
+                words[nwords ++ ] = p->toks[p->pos ++ ].word;
+            }
+            n->words = collect(p, words, nwords);
+            n->nwords = nwords;
+            free(words);
+        }
+        else n->implicit_list = 1;
+
+        skip_separators(p);
+        expect_keyword(p, "do");
+        n->body = parse_list(p);
+        expect_keyword(p, "done");
+        return n;
+    }
+
+    if (at_keyword(p, "{"))
+    {
+        p->pos ++ ;
+        n = p_alloc(p, sizeof(struct node));
+        n->type = N_GROUP;
+        n->line = line;
+        n->body = parse_list(p);
+        expect_keyword(p, "}");
+        return n;
+    }
+
+    // NAME() compound-command
+    if (plain_word(p, peek(p)) && p->toks[p->pos + 1].type == T_LPAREN)
+    {
+        n = p_alloc(p, sizeof(struct node));
+        n->type = N_FUNC;
+        n->line = line;
+        n->name = p->toks[p->pos].word;
+        p->pos += 2;
+        if (peek(p)->type != T_RPAREN) syntax_error(p, line, "syntax error: expected ')'");
+        p->pos ++ ;
+        while (peek(p)->type == T_NL) p->pos ++ ;
+        n->body = parse_command(p);
+        return n;
+    }
+
+    return parse_simple(p);
+}
+
+// 4. Compiler: lowers the AST to bytecode
+struct loop_ctx {
+    int is_for;
+    int top;                    // 'continue' target
+    int* breaks;                // jumps to patch with the loop exit
+    int nbreaks, breaks_cap;
+    struct loop_ctx* outer;
+};
+
+static void compile_list(struct parser* p, struct node* n);
+
+static const char* word_text(struct parser* p, int w)
+{
+    return p->b->prog.strings + p->b->prog.segs[p->b->prog.words[w].seg].str;
+}
+
+// Value part of NAME=value: the same segments, with the first one starting after '='
+static int assignment_value(struct builder* b, int w, size_t name_len)
+{
+    struct ksh_word src = b->prog.words[w];
+    int seg_start = b->prog.nsegs;
+    for (int k = 0; k < src.nsegs; k ++ )
+    {
+        struct ksh_seg seg = b->prog.segs[src.seg + k];
+        if (k == 0) seg.str += name_len + 1;
+        add_seg(b, seg);
+    }
+    GROW(b->prog.words, b->prog.nwords, b->words_cap);
+    b->prog.words[b->prog.nwords] = (struct ksh_word) { seg_start, src.nsegs, 1 };
+    return b->prog.nwords ++ ;
+}
+
+static void compile_command(struct parser* p, struct node* n)
+{
+    struct builder* b = p->b;
+
+    for (int k = 0; k < n->nassigns; k ++ )
+    {
+        const char* text = word_text(p, n->assigns[k]);
+        size_t name_len = strchr(text, '=') - text;
+        int name = add_string(b, text, name_len);
+        emit(b, OP_ASSIGN, name, assignment_value(b, n->assigns[k], name_len));
+    }
+    if (n->nwords == 0) return;
+
+    // return / break / continue are control flow, not commands
+    struct token t = { T_WORD, n->words[0], n->line };
+    const char* first = plain_word(p, &t);
+    if (first && strcmp(first, "return") == 0)
+    {
+        // 'return N' carries its status word along, plain 'return' keeps $?
+        if (n->nwords > 2) syntax_error(p, n->line, "'return' takes at most one argument");
+        if (n->nwords == 2) emit(b, OP_RET, add_list(b, n->words + 1, 1), 1);
+        else emit(b, OP_RET, 0, 0);
+        return;
+    }
+    if (first && n->nwords == 1 && (strcmp(first, "break") == 0 || strcmp(first, "continue") == 0))
+    {
+        struct loop_ctx* loop = p->loop;
+        if (loop == NULL) syntax_error(p, n->line, "'break' or 'continue' outside a loop");
+        if (first[0] == 'c') emit(b, OP_JMP, loop->top, 0);
+        else
+        {
+            if (loop->is_for) emit(b, OP_FOR_POP, 0, 0);
+            GROW(loop->breaks, loop->nbreaks, loop->breaks_cap);
+            loop->breaks[loop->nbreaks ++ ] = emit(b, OP_JMP, -1, 0);
+        }
+        return;
+    }
+
+    emit(b, OP_CMD, add_list(b, n->words, n->nwords), n->nwords);
+}
+
+static void compile_loop_end(struct parser* p, struct loop_ctx* loop)
+{
+    for (int k = 0; k < loop->nbreaks; k ++ ) p->b->prog.code[loop->breaks[k]].a = p->b->prog.ncode;
+    free(loop->breaks);
+    p->loop = loop->outer;
+}
+
+static void compile_node(struct parser* p, struct node* n)
+{
+    struct builder* b = p->b;
+    switch (n->type)
+    {
+        case N_CMD:
+            compile_command(p, n);
+            break;
+
+        case N_GROUP:
+            compile_list(p, n->body);
+            break;
+
+        case N_IF:
+        {
+            compile_list(p, n->cond);
+            int to_else = emit(b, OP_JFALSE, -1, 0);
+            compile_list(p, n->body);
+            if (n->orelse)
+            {
+                int to_end = emit(b, OP_JMP, -1, 0);
+                b->prog.code[to_else].a = b->prog.ncode;
+                compile_list(p, n->orelse);     // an elif is a nested N_IF
+                b->prog.code[to_end].a = b->prog.ncode;
+            }
+            else b->prog.code[to_else].a = b->prog.ncode;
+            break;
+        }
+
+        case N_WHILE:
+        {
+            struct loop_ctx loop = { 0, b->prog.ncode, NULL, 0, 0, p->loop };
+            p->loop = &loop;
+            compile_list(p, n->cond);
+            int to_exit = emit(b, OP_JFALSE, -1, 0);
+            compile_list(p, n->body);
+            emit(b, OP_JMP, loop.top, 0);
+            b->prog.code[to_exit].a = b->prog.ncode;
+            compile_loop_end(p, &loop);
+            break;
+        }
+
+        case N_FOR:
+        {
+            if (n->implicit_list)
+            {
+                // for NAME; do ... is for NAME in "$@"; do ...
+                GROW(b->prog.words, b->prog.nwords, b->words_cap);
+                add_seg(b, (struct ksh_seg) { add_string(b, "@", 1), KSH_SEG_VAR | KSH_SEG_QUOTED });
+                b->prog.words[b->prog.nwords] = (struct ksh_word) { b->prog.nsegs - 1, 1, 0 };
+                int w = b->prog.nwords ++ ;
+                emit(b, OP_FOR_START, add_list(b, &w, 1), 1);
+            }
+            else emit(b, OP_FOR_START, add_list(b, n->words, n->nwords), n->nwords);
+
+            const char* var = word_text(p, n->name);
+            struct loop_ctx loop = { 1, b->prog.ncode, NULL, 0, 0, p->loop };
+            p->loop = &loop;
+            int next = emit(b, OP_FOR_NEXT, add_string(b, var, strlen(var)), -1);
+            compile_list(p, n->body);
+            emit(b, OP_JMP, loop.top, 0);
+            b->prog.code[next].b = b->prog.ncode;
+            compile_loop_end(p, &loop);
+            break;
+        }
+
+        case N_FUNC:
+        {
+            // DEFUN name entry; JMP over; entry: body; RET; over:
+            const char* name = word_text(p, n->name);
+            int defun = emit(b, OP_DEFUN, add_string(b, name, strlen(name)), -1);
+            int over = emit(b, OP_JMP, -1, 0);
+            b->prog.code[defun].b = b->prog.ncode;
+            struct loop_ctx* outer = p->loop;
+            p->loop = NULL;     // break/continue do not reach out of a function
+            compile_node(p, n->body);
+            p->loop = outer;
+            emit(b, OP_RET, 0, 0);
+            b->prog.code[over].a = b->prog.ncode;
+            break;
+        }
+    }
+}
+
+static void compile_list(struct parser* p, struct node* n)
+{
+    for (; n != NULL; n = n->next) compile_node(p, n);
+}
+
+// Parse and compile a whole script, returns 0 on success
+static int ksh_compile(const char* path, const char* src, size_t len, struct ksh_program* out)
+{
+    struct builder b = { 0 };
+    struct parser p = { 0 };
+    int r = 0;
+    p.b = &b;
+    p.path = path;
+
+    if (setjmp(p.fail) == 0)
+    {
+        lex(&p, src, len);
+        struct node* root = parse_list(&p);
+        if (peek(&p)->type != T_EOF) syntax_error(&p, peek(&p)->line, "syntax error: unexpected token");
+        compile_list(&p, root);
+        emit(&b, OP_HALT, 0, 0);
+        *out = b.prog;
+    }
+    else
+    {
+        free(b.prog.code);
+        free(b.prog.segs);
+        free(b.prog.words);
+        free(b.prog.lists);
+        free(b.prog.strings);
+        r = -1;
+    }
+
+    for (int k = 0; k < p.nallocs; k ++ ) free(p.allocs[k]);
+    free(p.allocs);
+    free(p.toks);
+    free(p.buf);
+    return r;
+}
+
+// 5. Bytecode cache
+struct ksh_bc_header {
+    uint64_t magic;
+    int32_t version;
+    int32_t ncode, nsegs, nwords, nlists, nstrings;
+};
+
+static int bc_cache_path(const char* src, size_t len, const struct stat* st, char path[PATH_MAX])
+{
+    char dir[PATH_MAX], hex[KSH_HASH_MAX_HEX];
+    if (ksh_cache_dir("KSH_BYTECODE_DIR", "bytecode", dir) != 0) return -1;
+
+    // key: script contents + mtime + size + bytecode version
+    ksh_hash_ctx ctx;
+    int64_t stamp[4] = { st->st_mtim.tv_sec, st->st_mtim.tv_nsec, st->st_size, KSH_BC_VERSION };
+    ksh_hash_init(&ctx, KSH_HASH_SHA256);
+    ksh_hash_update(&ctx, src, len);
+    ksh_hash_update(&ctx, stamp, sizeof(stamp));
+    ksh_hash_final(&ctx, hex);
+    return ksh_path(path, "%s/%s.kbc", dir, hex);
+}
+
+// A cache file is only as trustworthy as the disk it sits on: before the VM
+// sees a loaded program, every index must point inside its table and every
+// jump inside the code, and the code must end in OP_HALT
+static int bc_in(int32_t i, int32_t n) { return i >= 0 && i < n; }
+static int bc_range(int32_t first, int32_t count, int32_t n) { return first >= 0 && count >= 0 && first <= n - count; }
+
+static int bc_check(const struct ksh_program* prog)
+{
+    if (prog->nstrings > 0 && prog->strings[prog->nstrings - 1] != '\0') return -1;
+    for (int k = 0; k < prog->nsegs; k ++ )
+        if (!bc_in(prog->segs[k].str, prog->nstrings)) return -1;
+    for (int k = 0; k < prog->nwords; k ++ )
+        if (!bc_range(prog->words[k].seg, prog->words[k].nsegs, prog->nsegs)) return -1;
+    for (int k = 0; k < prog->nlists; k ++ )
+        if (!bc_in(prog->lists[k], prog->nwords)) return -1;
+
+    for (int pc = 0; pc < prog->ncode; pc ++ )
+    {
+        const struct ksh_insn* in = &prog->code[pc];
+        int ok;
+        switch (in->op)
+        {
+            case OP_CMD:
+            case OP_FOR_START:
+            case OP_RET:        ok = bc_range(in->a, in->b, prog->nlists); break;
+            case OP_ASSIGN:     ok = bc_in(in->a, prog->nstrings) && bc_in(in->b, prog->nwords); break;
+            case OP_JMP:
+            case OP_JFALSE:     ok = bc_in(in->a, prog->ncode); break;
+            case OP_FOR_NEXT:
+            case OP_DEFUN:      ok = bc_in(in->a, prog->nstrings) && bc_in(in->b, prog->ncode); break;
+            case OP_FOR_POP:
+            case OP_HALT:       ok = 1; break;
+            default:            ok = 0; break;
+        }
+        if (!ok) return -1;
+    }
+    return prog->code[prog->ncode - 1].op == OP_HALT ? 0 : -1;
+}
+
+static int bc_load(const char* path, struct ksh_program* prog)
+{
+    struct ksh_bc_header h;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    int ok = fstat(fd, &st) == 0 && read(fd, &h, sizeof(h)) == sizeof(h) &&
+             h.magic == KSH_BC_MAGIC && h.version == KSH_BC_VERSION &&
+             h.ncode > 0 && h.nsegs >= 0 && h.nwords >= 0 && h.nlists >= 0 && h.nstrings >= 0;
+    size_t sizes[5] = { sizeof(struct ksh_insn) * h.ncode, sizeof(struct ksh_seg) * h.nsegs,
+                        sizeof(struct ksh_word) * h.nwords, sizeof(int32_t) * h.nlists, (size_t) h.nstrings };
+    if (ok && (size_t) st.st_size != sizeof(h) + sizes[0] + sizes[1] + sizes[2] + sizes[3] + sizes[4]) ok = 0;
+    if (!ok)
+    {
+        close(fd);
+        return -1;
+    }
+
+    void** arrays[5] = { (void**) &prog->code, (void**) &prog->segs, (void**) &prog->words, (void**) &prog->lists, (void**) &prog->strings };
+    for (int k = 0; k < 5; k ++ )
+    {
+        *arrays[k] = malloc(sizes[k] ? sizes[k] : 1);
+        if (!*arrays[k]) ksh_allocate_error();
+        if (sizes[k] && read(fd, *arrays[k], sizes[k]) != (ssize_t) sizes[k]) ok = 0;
+    }
+    close(fd);
+    prog->ncode = h.ncode;
+    prog->nsegs = h.nsegs;
+    prog->nwords = h.nwords;
+    prog->nlists = h.nlists;
+    prog->nstrings = h.nstrings;
+    return ok && bc_check(prog) == 0 ? 0 : -1;
+}
+
+static void bc_save(const char* path, const struct ksh_program* prog)
+{
+    char tmp[PATH_MAX];
+    if (ksh_path(tmp, "%s.%d", path, (int) getpid()) != 0) return;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) return;
+
+    struct ksh_bc_header h = { KSH_BC_MAGIC, KSH_BC_VERSION, prog->ncode, prog->nsegs, prog->nwords, prog->nlists, prog->nstrings };
+    int ok = write(fd, &h, sizeof(h)) == sizeof(h) &&
+             write(fd, prog->code, sizeof(struct ksh_insn) * prog->ncode) == (ssize_t) (sizeof(struct ksh_insn) * prog->ncode) &&
+             write(fd, prog->segs, sizeof(struct ksh_seg) * prog->nsegs) == (ssize_t) (sizeof(struct ksh_seg) * prog->nsegs) &&
+             write(fd, prog->words, sizeof(struct ksh_word) * prog->nwords) == (ssize_t) (sizeof(struct ksh_word) * prog->nwords) &&
+             write(fd, prog->lists, sizeof(int32_t) * prog->nlists) == (ssize_t) (sizeof(int32_t) * prog->nlists) &&
+             write(fd, prog->strings, prog->nstrings) == prog->nstrings;
+    // rename only a complete file into place, so readers never see a partial one
+    if (close(fd) != 0 || !ok || rename(tmp, path) != 0) unlink(tmp);
+}
+
+// 6. Virtual machine
+struct fields {
+    char** v;
+    int n, cap;
+    char* cur;          // field being built
+    size_t len, cur_cap;
+    int active;         // cur holds a field, even if it is empty
+};
+
+static void f_append(struct fields* f, const char* s, size_t n)
+{
+    if (f->len + n + 1 > f->cur_cap)
+    {
+        while (f->len + n + 1 > f->cur_cap) f->cur_cap = f->cur_cap ? f->cur_cap * 2 : 64;
+        f->cur = realloc(f->cur, f->cur_cap);
+        if (!f->cur) ksh_allocate_error();
+    }
+    memcpy(f->cur + f->len, s, n);
+    f->len += n;
+    f->cur[f->len] = '\0';
+    f->active = 1;
+}
+
+static void f_push(struct fields* f)
+{
+    if (!f->active) return;
+    if (f->n + 2 > f->cap)              // keep room for the closing NULL
+    {
+        f->cap = f->cap ? f->cap * 2 : 16;
+        f->v = realloc(f->v, sizeof(char*) * f->cap);
+        if (!f->v) ksh_allocate_error();
+    }
+    f->v[f->n] = strndup(f->cur ? f->cur : "", f->len);
+    if (!f->v[f->n]) ksh_allocate_error();
+    f->v[ ++ f->n] = NULL;
+    f->len = 0;
+    f->active = 0;
+}
+
+static void f_free_strings(char** v, int n)
+{
+    for (int k = 0; k < n; k ++ ) free(v[k]);
+    free(v);
+}
+
+struct vm_frame {
+    int ret_pc;
+    int argc;
+    char** argv;        // $0 $1 ...; owned by the frame except for the script's own
+    int iter_depth;     // for loops open when the function was called
+};
+
+struct vm_iter {
+    char** values;
+    int n, next;
+};
+
+struct vm_func {
+    const char* name;
+    int entry;
+};
+
+struct vm {
+    const struct ksh_program* prog;
+    struct vm_frame* frames;
+    int nframes, frames_cap;
+    struct vm_iter* iters;
+    int niters, iters_cap;
+    struct vm_func* funcs;
+    int nfuncs, funcs_cap;
+};
+
+// Expand one word into fields; unquoted variables are split on blanks
+static void expand_word(struct vm* vm, int w, struct fields* f, int split)
+{
+    const struct ksh_program* prog = vm->prog;
+    const struct vm_frame* frame = &vm->frames[vm->nframes - 1];
+    const struct ksh_word* word = &prog->words[w];
+    int spread = 0;
+    char num[32];
+
+    for (int k = 0; k < word->nsegs; k ++ )
+    {
+        const struct ksh_seg* seg = &prog->segs[word->seg + k];
+        const char* text = prog->strings + seg->str;
+        if (!(seg->flags & KSH_SEG_VAR))
+        {
+            f_append(f, text, strlen(text));
+            continue;
+        }
+
+        // "$@" and $@: every positional parameter is its own field
+        if (strcmp(text, "@") == 0 && split)
+        {
+            spread = 1;
+            for (int a = 1; a < frame->argc; a ++ )
+            {
+                if (a > 1) f_push(f);
+                f_append(f, frame->argv[a], strlen(frame->argv[a]));
+            }
+            continue;
+        }
+
+        const char* value = NULL;
+        char* joined = NULL;
+        if (strcmp(text, "?") == 0) { snprintf(num, sizeof(num), "%d", ksh_last_status); value = num; }
+        else if (strcmp(text, "#") == 0) { snprintf(num, sizeof(num), "%d", frame->argc - 1); value = num; }
+        else if (strcmp(text, "$") == 0) { snprintf(num, sizeof(num), "%d", (int) getpid()); value = num; }
+        else if (text[0] >= '0' && text[0] <= '9') value = (atoi(text) < frame->argc) ? frame->argv[atoi(text)] : "";
+        else if (strcmp(text, "*") == 0 || strcmp(text, "@") == 0)
+        {
+            struct fields j = { 0 };
+            for (int a = 1; a < frame->argc; a ++ )
+            {
+                if (a > 1) f_append(&j, " ", 1);
+                f_append(&j, frame->argv[a], strlen(frame->argv[a]));
+            }
+            joined = j.cur;
+            value = joined ? joined : "";
+        }
+        else value = getenv(text);
+        if (value == NULL) value = "";
+
+        if ((seg->flags & KSH_SEG_QUOTED) || !split)
+        {
+            f_append(f, value, strlen(value));
+        }
+        else
+        {
+            // field splitting: blanks end the current field
+            const char* s = value;
+            while (*s)
+            {
+                if (*s == ' ' || *s == '\t' || *s == '\n')
+                {
+                    f_push(f);
+                    while (*s == ' ' || *s == '\t' || *s == '\n') s ++ ;
+                    continue;
+                }
+                const char* e = s;
+                while (*e && *e != ' ' && *e != '\t' && *e != '\n') e ++ ;
+                f_append(f, s, e - s);
+                s = e;
+            }
+        }
+        free(joined);
+    }
+    // "" is an empty argument, but "$@" without parameters is none at all
+    if (word->quoted && !spread && !f->active) f_append(f, "", 0);
+    f_push(f);
+}
+
+static void expand_list(struct vm* vm, int start, int count, struct fields* f)
+{
+    memset(f, 0, sizeof(*f));
+    for (int k = 0; k < count; k ++ ) expand_word(vm, vm->prog->lists[start + k], f, 1);
+    free(f->cur);
+    f->cur = NULL;
+}
+
+static void push_frame(struct vm* vm, int ret_pc, int argc, char** argv)
+{
+    GROW(vm->frames, vm->nframes, vm->frames_cap);
+    vm->frames[vm->nframes ++ ] = (struct vm_frame) { ret_pc, argc, argv, vm->niters };
+}
+
+static void pop_iter(struct vm* vm)
+{
+    if (vm->niters == 0) return;
+    struct vm_iter* it = &vm->iters[ -- vm->niters];
+    f_free_strings(it->values, it->n);
+}
+
+// Returns 0 if the script ran 'exit', 1 otherwise
+static int ksh_vm_run(const struct ksh_program* prog, int argc, char** argv)
+{
+    struct vm vm = { 0 };
+    int pc = 0, halted = 0, exited = 0;
+    vm.prog = prog;
+    push_frame(&vm, -1, argc, argv);
+
+    while (!halted && !exited)
+    {
+        const struct ksh_insn* in = &prog->code[pc ++ ];
+        switch (in->op)
+        {
+            case OP_CMD:
+            {
+                struct fields f;
+                ksh_reap_jobs();
+                // collect 'cmd &' jobs as the interactive loop does, and free their CPUs
+                expand_list(&vm, in->a, in->b, &f);
+                if (f.n == 0) { free(f.v); break; }
+
+                int func = -1;
+                for (int k = 0; k < vm.nfuncs; k ++ ) if (strcmp(vm.funcs[k].name, f.v[0]) == 0) func = k;
+                if (func >= 0)
+                {
+                    // the frame owns the fields until the function returns
+                    push_frame(&vm, pc, f.n, f.v);
+                    pc = vm.funcs[func].entry;
+                    break;
+                }
+
+                // built-ins may rewrite their argv, so hand them a copy of the pointers
+                char** call = malloc(sizeof(char*) * (f.n + 1));
+                if (!call) ksh_allocate_error();
+                memcpy(call, f.v, sizeof(char*) * (f.n + 1));
+                if (ksh_execute(call) == 0) exited = 1;
+                free(call);
+                f_free_strings(f.v, f.n);
+                break;
+            }
+
+            case OP_ASSIGN:
+            {
+                struct fields f = { 0 };
+                expand_word(&vm, in->b, &f, 0);
+                setenv(prog->strings + in->a, f.n ? f.v[0] : "", 1);
+                f_free_strings(f.v, f.n);
+                free(f.cur);
+                ksh_last_status = 0;
+                break;
+            }
+
+            case OP_JMP:
+                pc = in->a;
+                break;
+
+            case OP_JFALSE:
+                if (ksh_last_status != 0) pc = in->a;
+                break;
+
+            case OP_FOR_START:
+            {
+                struct fields f;
+                expand_list(&vm, in->a, in->b, &f);
+                GROW(vm.iters, vm.niters, vm.iters_cap);
+                vm.iters[vm.niters ++ ] = (struct vm_iter) { f.v, f.n, 0 };
+                break;
+            }
+
+            case OP_FOR_NEXT:
+            {
+                struct vm_iter* it = vm.niters ? &vm.iters[vm.niters - 1] : NULL;
+                if (it && it->next < it->n) setenv(prog->strings + in->a, it->values[it->next ++ ], 1);
+                else
+                {
+                    pop_iter(&vm);
+                    pc = in->b;
+                }
+                break;
+            }
+
+            case OP_FOR_POP:
+                pop_iter(&vm);
+                break;
+
+            case OP_DEFUN:
+            {
+                int k = 0;
+                while (k < vm.nfuncs && strcmp(vm.funcs[k].name, prog->strings + in->a) != 0) k ++ ;
+                if (k == vm.nfuncs)
+                {
+                    GROW(vm.funcs, vm.nfuncs, vm.funcs_cap);
+                    vm.nfuncs ++ ;
+                }
+                vm.funcs[k] = (struct vm_func) { prog->strings + in->a, in->b };
+                break;
+            }
+
+            case OP_RET:
+            {
+                if (in->b > 0)
+                {
+                    struct fields f;
+                    expand_list(&vm, in->a, in->b, &f);
+                    char* end = NULL;
+                    long n = f.n == 1 ? strtol(f.v[0], &end, 10) : 0;
+                    if (end == NULL || end == f.v[0] || *end != '\0')
+                    {
+                        fprintf(stderr, "ksh: return: numeric argument required\n");
+                        n = 2;
+                    }
+                    ksh_last_status = n & 0xff;
+                    f_free_strings(f.v, f.n);
+                }
+                // 'return' outside any function ends the script
+                if (vm.nframes == 1) { pc = prog->ncode - 1; break; }
+                struct vm_frame* frame = &vm.frames[ -- vm.nframes];
+                while (vm.niters > frame->iter_depth) pop_iter(&vm);
+                f_free_strings(frame->argv, frame->argc);
+                pc = frame->ret_pc;
+                break;
+            }
+
+            case OP_HALT:
+            default:
+                halted = 1;
+                break;
+        }
+    }
+
+    // 'exit' can come from inside functions and loops
+    while (vm.niters > 0) pop_iter(&vm);
+    while (vm.nframes > 1)
+    {
+        vm.nframes -- ;
+        f_free_strings(vm.frames[vm.nframes].argv, vm.frames[vm.nframes].argc);
+    }
+    free(vm.frames);
+    free(vm.iters);
+    free(vm.funcs);
+    return !exited;
+}
+
+// 7. Run a script file
+int ksh_run_script(const char* path, int argc, char** argv)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "ksh: %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        ksh_last_status = 127;
+        return 1;
+    }
+
+    char* src = malloc(st.st_size + 1);
+    if (!src) ksh_allocate_error();
+    ssize_t got = 0, n;
+    while (got < st.st_size && (n = read(fd, src + got, st.st_size - got)) > 0) got += n;
+    close(fd);
+
+    struct ksh_program prog = { 0 };
+    char cache[PATH_MAX];
+    int cached = bc_cache_path(src, got, &st, cache) == 0;
+
+    // (1) bytecode from an earlier run of the same script
+    KSH_TRACE_BEGIN(t_load);
+    int loaded = cached && bc_load(cache, &prog) == 0;
+    KSH_TRACE_END(t_load, "bytecode load", loaded ? path : NULL);
+
+    // (2) otherwise parse and compile, then keep the result for next time
+    if (!loaded)
+    {
+        free(prog.code); free(prog.segs); free(prog.words); free(prog.lists); free(prog.strings);
+        memset(&prog, 0, sizeof(prog));
+        KSH_TRACE_BEGIN(t_parse);
+        int compiled = ksh_compile(path, src, got, &prog) == 0;
+        KSH_TRACE_END(t_parse, "parse", path);
+        if (!compiled)
+        {
+            free(src);
+            ksh_last_status = 2;
+            return 1;
+        }
+        if (cached) bc_save(cache, &prog);
+    }
+    free(src);
+
+    int status = ksh_vm_run(&prog, argc, argv);
+    free(prog.code);
+    free(prog.segs);
+    free(prog.words);
+    free(prog.lists);
+    free(prog.strings);
+    return status;
+}
+
+// source command: source <script> [args...]
+int ksh_source(char** args)
+{
+    if (args[1] == NULL)
+    {
+        fprintf(stderr, "Usage: source <script> [args...]\n");
+        ksh_last_status = 2;
+        return 1;
+    }
+    int argc = 0;
+    while (args[argc + 1] != NULL) argc ++ ;
+    return ksh_run_script(args[1], argc, &args[1]);
+}
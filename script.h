@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+// Compiled form of a script. Everything is stored in flat arrays that refer
+// to each other by index, never by pointer, so a program can be written to
+// the bytecode cache and mapped back as is.
+
+enum ksh_opcode {
+    OP_CMD,         // a: first word in lists, b: word count      run a command or function
+    OP_ASSIGN,      // a: name (string offset), b: value word     NAME=value
+    OP_JMP,         // a: target
+    OP_JFALSE,      // a: target                                  jump if $? is not 0
+    OP_FOR_START,   // a: first word in lists, b: word count      expand the 'in' list
+    OP_FOR_NEXT,    // a: variable name, b: target when done      next loop value
+    OP_FOR_POP,     //                                            'break' out of a for loop
+    OP_DEFUN,       // a: function name, b: entry point
+    OP_RET,         // a: status word in lists, b: 0 or 1         end of a function body, $? = word
+    OP_HALT         //                                            end of the script
+};
+
+struct ksh_insn {
+    int32_t op, a, b;
+};
+
+// One piece of a word: literal text or a variable reference
+#define KSH_SEG_LIT 0
+#define KSH_SEG_VAR 1
+#define KSH_SEG_QUOTED 2    // flag: inside double quotes, so no field splitting
+
+struct ksh_seg {
+    int32_t str;            // offset into the string pool
+    int32_t flags;
+};
+
+struct ksh_word {
+    int32_t seg, nsegs;     // range in the segment table
+    int32_t quoted;         // had quotes somewhere, so "" still makes an argument
+};
+
+struct ksh_program {
+    struct ksh_insn* code;
+    struct ksh_seg* segs;
+    struct ksh_word* words;
+    int32_t* lists;         // word indices of command arguments and for lists
+    char* strings;          // NUL-terminated strings
+    int32_t ncode, nsegs, nwords, nlists, nstrings;
+};
+
+// Function declarations for running scripts
+extern int ksh_run_script(const char* path, int argc, char** argv);
@@ -0,0 +1,800 @@
+#define _GNU_SOURCE
+#include "built-in.h"
+#include "launch.h"
+#include "pool.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <linux/limits.h>
+
+// sort [-b] [-n] [-u] [-t CHAR] [-k N[,M]] [-S SIZE] [-T DIR] [file...]
+//
+// Lines are compared byte by byte, as sort does with LC_ALL=C. Input is
+// read in large blocks into a buffer bounded by the memory cap (-S, or
+// $KSH_SORT_MEMORY, default 256M). Each full buffer becomes one sorted run:
+// its records are split into one slice per worker thread, the slices are
+// sorted in parallel and merged with a loser tree. When the input does not
+// fit in one buffer the runs are spilled to unlinked temp files in -T DIR
+// ($TMPDIR or /tmp) and merged the same way at the end.
+//
+// A record keeps the first 8 bytes of its key (or, with -n, the sign,
+// number of integer digits and first 13 digits of the key) in a big-endian
+// integer next to the pointer, so almost every comparison is decided
+// without touching the line itself. -n compares numbers as decimal strings
+// like GNU sort does, so keys of any length order exactly. Runs are stored
+// front-coded: each line only stores what differs from the line before,
+// which sorted input shares a lot of, so a spill writes a fraction of the
+// input size.
+//
+// Without -t, fields are separated by runs of blanks, and as in GNU sort
+// the blanks before a field belong to it; -b skips them at the start of a
+// key. Equal keys fall back to comparing whole lines,
+// except with -u, which prints one line of each group of equal keys.
+
+#define SORT_READ_CHUNK (16 << 20)      // bytes per read()
+#define SORT_IO_BUF (1 << 20)           // output and run writer buffer
+#define SORT_RUN_BUF (256 << 10)        // read buffer per run in a merge
+#define SORT_FANIN 128                  // runs merged at once
+#define SORT_SLICE_MIN 65536            // records per slice before splitting pays off
+
+struct sort_opts {
+    int numeric, unique;
+    int blank;                  // -b: leading blanks are not part of a key
+    int key_start, key_end;     // 1-based fields, 0: whole line / end of line
+    char sep;                   // field separator, 0: blanks
+    size_t memory;              // memory cap in bytes
+    const char* tmpdir;
+};
+
+// One line, with its key located and its key prefix precomputed
+struct sort_item {
+    uint64_t prefix;
+    const char* line;
+    uint32_t len, koff, klen;
+};
+
+// 1. Keys and comparison
+static inline int sort_isblank(char c) { return c == ' ' || c == '\t'; }
+
+// Byte range of field n (1-based) in line[0..len), returns its start
+static size_t sort_field(const struct sort_opts* o, const char* line, size_t len, int n, size_t* end)
+{
+    size_t i = 0;
+    if (o->sep)
+    {
+        for (int f = 1; f < n && i < len; f ++ )
+        {
+            const char* s = memchr(line + i, o->sep, len - i);
+            i = s ? (size_t) (s - line) + 1 : len;
+        }
+        const char* s = memchr(line + i, o->sep, len - i);
+        *end = s ? (size_t) (s - line) : len;
+        while (o->blank && i < *end && sort_isblank(line[i])) i ++ ;
+        return i;
+    }
+
+    for (int f = 1; ; f ++ )
+    {
+        size_t start = i;
+        while (i < len && sort_isblank(line[i])) i ++ ;
+        if (o->blank) start = i;
+        while (i < len && !sort_isblank(line[i])) i ++ ;
+        if (f == n || i >= len)
+        {
+            *end = i;
+            return f == n ? start : len;
+        }
+    }
+}
+
+// -n number in s[0..len): optional blanks and '-', digits, '.', digits;
+// anything else is 0. Leading zeros of the integer part and trailing zeros
+// of the fraction are dropped, so equal numbers have equal digits.
+struct sort_num {
+    int neg;
+    const char* ip;             // integer digits
+    size_t ilen;
+    const char* fp;             // fraction digits
+    size_t flen;
+};
+
+static inline int sort_isdigit(char c) { return c >= '0' && c <= '9'; }
+
+static void sort_number(const char* s, size_t len, struct sort_num* n)
+{
+    size_t i = 0;
+    while (i < len && sort_isblank(s[i])) i ++ ;
+    n->neg = i < len && s[i] == '-';
+    if (n->neg) i ++ ;
+    while (i < len && s[i] == '0') i ++ ;
+    n->ip = s + i;
+    while (i < len && sort_isdigit(s[i])) i ++ ;
+    n->ilen = s + i - n->ip;
+    n->fp = s + i + 1;
+    n->flen = 0;
+    if (i < len && s[i] == '.')
+        for (i ++ ; i < len && sort_isdigit(s[i]); i ++ ) if (s[i] != '0') n->flen = s + i + 1 - n->fp;
+    if (n->ilen == 0 && n->flen == 0) n->neg = 0;       // -0 sorts with 0
+}
+
+// Compare two numbers digit by digit: sign, integer length, integer digits, fraction
+static int sort_numcmp(const struct sort_num* a, const struct sort_num* b)
+{
+    if (a->neg != b->neg) return a->neg ? -1 : 1;
+    int r = 0;
+    if (a->ilen != b->ilen) r = a->ilen < b->ilen ? -1 : 1;
+    else if ((r = memcmp(a->ip, b->ip, a->ilen)) == 0)
+    {
+        size_t n = a->flen < b->flen ? a->flen : b->flen;
+        if ((r = memcmp(a->fp, b->fp, n)) == 0 && a->flen != b->flen) r = a->flen < b->flen ? -1 : 1;
+    }
+    return a->neg ? -r : r;
+}
+
+// Order-preserving prefix of a number: 2 bits of sign (negative, zero,
+// positive), 16 bits of integer length, then the first 13 significant
+// digits (integer digits followed by fraction digits) as a decimal value;
+// negatives have the magnitude part inverted
+static uint64_t sort_num_prefix(const struct sort_num* n)
+{
+    if (n->ilen == 0 && n->flen == 0) return 1ull << 62;
+    uint64_t digits = 0;
+    for (size_t k = 0; k < 13; k ++ )
+    {
+        char c = k < n->ilen ? n->ip[k] : k - n->ilen < n->flen ? n->fp[k - n->ilen] : '0';
+        digits = digits * 10 + (c - '0');
+    }
+    uint64_t mag = ((uint64_t) (n->ilen < 0xffff ? n->ilen : 0xffff) << 46) | digits;
+    return n->neg ? (~mag & ((1ull << 62) - 1)) : (2ull << 62) | mag;
+}
+
+static void sort_make_item(const struct sort_opts* o, const char* line, size_t len, struct sort_item* it)
+{
+    size_t kstart = 0, kend = len;
+    it->line = line;
+    it->len = len;
+    if (o->key_start)
+    {
+        kstart = sort_field(o, line, len, o->key_start, &kend);
+        if (o->key_end == 0) kend = len;
+        else if (o->key_end > o->key_start) sort_field(o, line, len, o->key_end, &kend);
+        if (kend < kstart) kend = kstart;
+    }
+    it->koff = kstart;
+    it->klen = kend - kstart;
+
+    if (o->numeric)
+    {
+        struct sort_num n;
+        sort_number(line + kstart, it->klen, &n);
+        it->prefix = sort_num_prefix(&n);
+    }
+    else
+    {
+        uint64_t p = 0;
+        for (size_t k = 0; k < 8; k ++ ) p = (p << 8) | (k < it->klen ? (unsigned char) line[kstart + k] : 0);
+        it->prefix = p;
+    }
+}
+
+static int sort_cmp(const struct sort_opts* o, const struct sort_item* a, const struct sort_item* b)
+{
+    if (a->prefix != b->prefix) return a->prefix < b->prefix ? -1 : 1;
+    if (o->numeric)
+    {
+        // same sign, length and leading digits: the rest of the digits decide
+        struct sort_num x, y;
+        sort_number(a->line + a->koff, a->klen, &x);
+        sort_number(b->line + b->koff, b->klen, &y);
+        int r = sort_numcmp(&x, &y);
+        if (r) return r;
+    }
+    else if (a->klen > 8 || b->klen > 8)
+    {
+        size_t n = a->klen < b->klen ? a->klen : b->klen;
+        int r = memcmp(a->line + a->koff, b->line + b->koff, n);
+        if (r) return r;
+    }
+    if (!o->numeric && a->klen != b->klen) return a->klen < b->klen ? -1 : 1;
+    if (o->unique) return 0;
+
+    // last resort: the whole line
+    size_t n = a->len < b->len ? a->len : b->len;
+    int r = memcmp(a->line, b->line, n);
+    if (r) return r;
+    return a->len < b->len ? -1 : a->len > b->len;
+}
+
+static int sort_qsort_cmp(const void* a, const void* b, void* o)
+{
+    return sort_cmp(o, a, b);
+}
+
+// 2. Buffered output and front-coded runs
+struct sort_out {
+    int fd;
+    char* buf;
+    size_t len;
+    int error;
+};
+
+static void out_flush(struct sort_out* w)
+{
+    size_t done = 0;
+    while (done < w->len && !w->error)
+    {
+        ssize_t n = write(w->fd, w->buf + done, w->len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) w->error = n < 0 ? errno : EIO;
+        else done += n;
+    }
+    w->len = 0;
+}
+
+static void out_put(struct sort_out* w, const void* data, size_t len)
+{
+    while (len > 0)
+    {
+        if (w->len == SORT_IO_BUF) out_flush(w);
+        size_t n = SORT_IO_BUF - w->len < len ? SORT_IO_BUF - w->len : len;
+        memcpy(w->buf + w->len, data, n);
+        w->len += n;
+        data = (const char*) data + n;
+        len -= n;
+    }
+}
+
+static void out_varint(struct sort_out* w, uint64_t v)
+{
+    unsigned char b[10];
+    int n = 0;
+    do
+    {
+        b[n ++ ] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+        v >>= 7;
+    } while (v);
+    out_put(w, b, n);
+}
+
+// Where merged lines go: a run file (front-coded) or the final output
+struct sort_sink {
+    struct sort_out out;
+    int run;                    // write front-coded run records
+    char* prev;                 // previous line, for front coding and -u
+    size_t prev_len, prev_cap;
+    struct sort_item prev_item;
+    int have_prev;
+};
+
+static void sink_put(const struct sort_opts* o, struct sort_sink* s, const struct sort_item* it)
+{
+    if (o->unique && s->have_prev && sort_cmp(o, &s->prev_item, it) == 0) return;
+
+    if (s->run)
+    {
+        size_t shared = 0, max = s->prev_len < it->len ? s->prev_len : it->len;
+        while (shared < max && s->prev[shared] == it->line[shared]) shared ++ ;
+        out_varint(&s->out, shared);
+        out_varint(&s->out, it->len - shared);
+        out_put(&s->out, it->line + shared, it->len - shared);
+    }
+    else
+    {
+        out_put(&s->out, it->line, it->len);
+        out_put(&s->out, "\n", 1);
+    }
+
+    // keep a copy: the item's line may not outlive the next read
+    if (s->run || o->unique)
+    {
+        if (it->len > s->prev_cap)
+        {
+            s->prev_cap = it->len * 2 + 64;
+            s->prev = realloc(s->prev, s->prev_cap);
+            if (!s->prev) ksh_allocate_error();
+        }
+        memcpy(s->prev, it->line, it->len);
+        s->prev_len = it->len;
+        s->prev_item = *it;
+        s->prev_item.line = s->prev;
+        s->have_prev = 1;
+    }
+}
+
+// Reader for one run file
+struct run_reader {
+    int fd;
+    char* buf;
+    size_t pos, end;
+    char* line;
+    size_t len, cap;
+};
+
+static int rd_byte(struct run_reader* r)
+{
+    if (r->pos == r->end)
+    {
+        ssize_t n;
+        do n = read(r->fd, r->buf, SORT_RUN_BUF); while (n < 0 && errno == EINTR);
+        if (n <= 0) return -1;
+        r->pos = 0;
+        r->end = n;
+    }
+    return (unsigned char) r->buf[r->pos ++ ];
+}
+
+static int rd_varint(struct run_reader* r, uint64_t* v)
+{
+    int c, shift = 0;
+    *v = 0;
+    do
+    {
+        if ((c = rd_byte(r)) < 0 || shift > 63) return -1;
+        *v |= (uint64_t) (c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    return 0;
+}
+
+// Next line of the run into r->line, returns 0 at the end
+static int rd_next(struct run_reader* r)
+{
+    uint64_t shared, rest;
+    if (rd_varint(r, &shared) != 0 || rd_varint(r, &rest) != 0 || shared > r->len) return 0;
+    if (shared + rest > r->cap)
+    {
+        r->cap = (shared + rest) * 2 + 64;
+        r->line = realloc(r->line, r->cap);
+        if (!r->line) ksh_allocate_error();
+    }
+    for (uint64_t k = 0; k < rest; k ++ )
+    {
+        int c = rd_byte(r);
+        if (c < 0) return 0;
+        r->line[shared + k] = c;
+    }
+    r->len = shared + rest;
+    return 1;
+}
+
+// 3. Loser tree over k sorted sources (memory slices or run files)
+struct sort_src {
+    struct sort_item cur;
+    int done;
+    struct sort_item* items;    // memory slice
+    size_t pos, n;
+    struct run_reader* rd;      // or run file
+};
+
+struct sort_merge {
+    const struct sort_opts* o;
+    struct sort_src* src;
+    int k;
+    int* node;                  // node[0]: winner, node[1..k-1]: losers
+};
+
+static void src_next(const struct sort_opts* o, struct sort_src* s)
+{
+    if (s->rd)
+    {
+        if (rd_next(s->rd)) sort_make_item(o, s->rd->line, s->rd->len, &s->cur);
+        else s->done = 1;
+    }
+    else if (s->pos < s->n) s->cur = s->items[s->pos ++ ];
+    else s->done = 1;
+}
+
+// Does source a come before source b? Exhausted sources come last, ties go
+// to the lower index so equal lines keep their input order
+static int merge_less(struct sort_merge* m, int a, int b)
+{
+    if (m->src[a].done) return 0;
+    if (m->src[b].done) return 1;
+    int r = sort_cmp(m->o, &m->src[a].cur, &m->src[b].cur);
+    return r < 0 || (r == 0 && a < b);
+}
+
+// Leaves are nodes k..2k-1; returns the winner of the subtree at node
+static int merge_build(struct sort_merge* m, int node)
+{
+    if (node >= m->k) return node - m->k;
+    int a = merge_build(m, 2 * node), b = merge_build(m, 2 * node + 1);
+    if (merge_less(m, b, a))
+    {
+        m->node[node] = a;
+        return b;
+    }
+    m->node[node] = b;
+    return a;
+}
+
+static void merge_run(const struct sort_opts* o, struct sort_src* src, int k, struct sort_sink* sink)
+{
+    struct sort_merge m = { o, src, k, malloc(sizeof(int) * (k + 1)) };
+    if (!m.node) ksh_allocate_error();
+    for (int i = 0; i < k; i ++ ) src_next(o, &src[i]);
+    int w = merge_build(&m, 1 < k ? 1 : k);
+
+    while (!src[w].done)
+    {
+        sink_put(o, sink, &src[w].cur);
+        src_next(o, &src[w]);
+
+        // replay the matches on the way from the winner's leaf to the root
+        for (int node = (w + k) / 2; node >= 1; node /= 2)
+            if (merge_less(&m, m.node[node], w))
+            {
+                int t = m.node[node];
+                m.node[node] = w;
+                w = t;
+            }
+    }
+    free(m.node);
+}
+
+// 4. Sorting one buffer
+struct sort_slices {
+    const struct sort_opts* o;
+    struct sort_item* items;
+    size_t n;
+    int nslices;
+};
+
+static void sort_slice_worker(int i, void* arg)
+{
+    struct sort_slices* s = arg;
+    size_t from = s->n * i / s->nslices, to = s->n * (i + 1) / s->nslices;
+    qsort_r(s->items + from, to - from, sizeof(struct sort_item), sort_qsort_cmp, (void*) s->o);
+}
+
+// Sort items in parallel and send them, merged, to sink
+static void sort_buffer(const struct sort_opts* o, struct sort_item* items, size_t n, struct sort_sink* sink)
+{
+    int nslices = n / SORT_SLICE_MIN;
+    if (nslices > ksh_pool_threads()) nslices = ksh_pool_threads();
+    if (nslices < 1) nslices = 1;
+
+    struct sort_slices s = { o, items, n, nslices };
+    ksh_parallel_for(nslices, sort_slice_worker, &s);
+
+    struct sort_src* src = calloc(nslices, sizeof(struct sort_src));
+    if (!src) ksh_allocate_error();
+    for (int i = 0; i < nslices; i ++ )
+    {
+        src[i].items = items + n * i / nslices;
+        src[i].n = n * (i + 1) / nslices - n * i / nslices;
+    }
+    merge_run(o, src, nslices, sink);
+    free(src);
+}
+
+// 5. Runs on disk
+struct sort_state {
+    const struct sort_opts* o;
+    int* runs;                  // file descriptors of unlinked run files
+    int nruns, runs_cap;
+    uint64_t spilled;           // bytes written to runs
+};
+
+static int run_create(struct sort_state* st)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/ksh-sort-XXXXXX", st->o->tmpdir);
+    int fd = mkostemp(path, O_CLOEXEC);
+    if (fd < 0) return -1;
+    unlink(path);               // gone as soon as the shell closes it, even after a crash
+    return fd;
+}
+
+static void sink_init(struct sort_sink* s, int fd, int run)
+{
+    memset(s, 0, sizeof(*s));
+    s->out.fd = fd;
+    s->out.buf = malloc(SORT_IO_BUF);
+    if (!s->out.buf) ksh_allocate_error();
+    s->run = run;
+}
+
+static int sink_close(struct sort_sink* s)
+{
+    out_flush(&s->out);
+    free(s->out.buf);
+    free(s->prev);
+    return s->out.error ? (errno = s->out.error, -1) : 0;
+}
+
+static int run_add(struct sort_state* st, int fd)
+{
+    if (st->nruns == st->runs_cap)
+    {
+        st->runs_cap = st->runs_cap ? st->runs_cap * 2 : 16;
+        st->runs = realloc(st->runs, sizeof(int) * st->runs_cap);
+        if (!st->runs) ksh_allocate_error();
+    }
+    st->runs[st->nruns ++ ] = fd;
+    return 0;
+}
+
+// Sort the buffer's items into a new run file
+static int spill(struct sort_state* st, struct sort_item* items, size_t n)
+{
+    struct sort_sink sink;
+    int fd = run_create(st);
+    if (fd < 0) return -1;
+
+    KSH_TRACE_BEGIN(t_spill);
+    sink_init(&sink, fd, 1);
+    sort_buffer(st->o, items, n, &sink);
+    int r = sink_close(&sink);
+    KSH_TRACE_END(t_spill, "sort spill", NULL);
+
+    st->spilled += lseek(fd, 0, SEEK_CUR);
+    if (r != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return run_add(st, fd);
+}
+
+// Merge runs[from..from+k) into sink, closing them
+static int merge_runs(struct sort_state* st, int from, int k, struct sort_sink* sink)
+{
+    struct sort_src* src = calloc(k, sizeof(struct sort_src));
+    struct run_reader* rd = calloc(k, sizeof(struct run_reader));
+    if (!src || !rd) ksh_allocate_error();
+    for (int i = 0; i < k; i ++ )
+    {
+        rd[i].fd = st->runs[from + i];
+        rd[i].buf = malloc(SORT_RUN_BUF);
+        if (!rd[i].buf) ksh_allocate_error();
+        lseek(rd[i].fd, 0, SEEK_SET);
+        src[i].rd = &rd[i];
+    }
+
+    KSH_TRACE_BEGIN(t_merge);
+    merge_run(st->o, src, k, sink);
+    KSH_TRACE_END(t_merge, "sort merge", NULL);
+
+    for (int i = 0; i < k; i ++ )
+    {
+        close(rd[i].fd);
+        free(rd[i].buf);
+        free(rd[i].line);
+    }
+    free(rd);
+    free(src);
+    return 0;
+}
+
+// 6. Reading the input
+struct sort_input {
+    char* buf;
+    size_t cap, used, parsed;   // parsed: start of the first incomplete line
+    struct sort_item* items;
+    size_t n, items_cap, items_max;
+};
+
+static void input_parse(const struct sort_opts* o, struct sort_input* in)
+{
+    while (in->parsed < in->used && in->n < in->items_max)
+    {
+        char* nl = memchr(in->buf + in->parsed, '\n', in->used - in->parsed);
+        if (nl == NULL) break;
+        if (in->n == in->items_cap)
+        {
+            in->items_cap = in->items_cap ? in->items_cap * 2 : 65536;
+            if (in->items_cap > in->items_max) in->items_cap = in->items_max;
+            in->items = realloc(in->items, sizeof(struct sort_item) * in->items_cap);
+            if (!in->items) ksh_allocate_error();
+        }
+        sort_make_item(o, in->buf + in->parsed, nl - (in->buf + in->parsed), &in->items[in->n ++ ]);
+        in->parsed = nl - in->buf + 1;
+    }
+}
+
+// The buffer is full: spill what is parsed and keep the incomplete line,
+// or grow the buffer if a single line fills it
+static int input_make_room(struct sort_state* st, struct sort_input* in)
+{
+    if (in->n > 0)
+    {
+        if (spill(st, in->items, in->n) != 0) return -1;
+        memmove(in->buf, in->buf + in->parsed, in->used - in->parsed);
+        in->used -= in->parsed;
+        in->parsed = 0;
+        in->n = 0;
+    }
+    if (in->used == in->cap)
+    {
+        in->cap *= 2;
+        in->buf = realloc(in->buf, in->cap);
+        if (!in->buf) ksh_allocate_error();
+    }
+    return 0;
+}
+
+static int input_read_fd(struct sort_state* st, struct sort_input* in, int fd)
+{
+    while (1)
+    {
+        if (in->used == in->cap || in->n == in->items_max)
+            if (input_make_room(st, in) != 0) return -1;
+
+        size_t want = in->cap - in->used < SORT_READ_CHUNK ? in->cap - in->used : SORT_READ_CHUNK;
+        ssize_t got = read(fd, in->buf + in->used, want);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) return -1;
+        if (got == 0) break;
+        in->used += got;
+        input_parse(st->o, in);
+    }
+
+    // a last line without '\n' still counts
+    while (in->parsed < in->used)
+    {
+        input_parse(st->o, in);
+        if (in->parsed == in->used) break;
+        if (memchr(in->buf + in->parsed, '\n', in->used - in->parsed) == NULL)
+        {
+            if (in->used == in->cap && input_make_room(st, in) != 0) return -1;
+            in->buf[in->used ++ ] = '\n';
+        }
+        else if (input_make_room(st, in) != 0) return -1;
+    }
+    return 0;
+}
+
+// 7. sort command
+static size_t sort_parse_size(const char* s)
+{
+    char* end;
+    double v = strtod(s, &end);
+    switch (*end)
+    {
+        case 'k': case 'K': v *= 1024; break;
+        case 'm': case 'M': v *= 1024 * 1024; break;
+        case 'g': case 'G': v *= 1024.0 * 1024 * 1024; break;
+        case '\0': break;
+        default: return 0;
+    }
+    return v > 0 ? (size_t) v : 0;
+}
+
+int ksh_sort(char** args)
+{
+    struct sort_opts o = { 0 };
+    const char* env = getenv("KSH_SORT_MEMORY");
+    o.memory = env ? sort_parse_size(env) : 0;
+    if (o.memory == 0) o.memory = 256 << 20;
+    o.tmpdir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+
+    // Parse the options, flags may be combined as in -nu
+    int i = 1;
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i ++ )
+    {
+        for (char* f = args[i] + 1; *f; f ++ )
+        {
+            if (*f == 'b') { o.blank = 1; continue; }
+            if (*f == 'n') { o.numeric = 1; continue; }
+            if (*f == 'u') { o.unique = 1; continue; }
+
+            // options with a value: -tX or -t X
+            char* value = f[1] ? f + 1 : args[ ++ i];
+            if (value == NULL || !strchr("tkST", *f))
+            {
+                fprintf(stderr, "Usage: sort [-b] [-n] [-u] [-t char] [-k N[,M]] [-S size] [-T dir] [file...]\n");
+                ksh_last_status = 2;
+                return 1;
+            }
+            if (*f == 't') o.sep = value[0];
+            else if (*f == 'k')
+            {
+                o.key_start = atoi(value);
+                o.key_end = strchr(value, ',') ? atoi(strchr(value, ',') + 1) : 0;
+                if (o.key_start < 1)
+                {
+                    fprintf(stderr, "ksh: sort: invalid key \'%s\'\n", value);
+                    ksh_last_status = 2;
+                    return 1;
+                }
+            }
+            else if (*f == 'S' && (o.memory = sort_parse_size(value)) == 0)
+            {
+                fprintf(stderr, "ksh: sort: invalid size \'%s\'\n", value);
+                ksh_last_status = 2;
+                return 1;
+            }
+            else if (*f == 'T') o.tmpdir = value;
+            break;
+        }
+    }
+    if (o.memory < (4 << 20)) o.memory = 4 << 20;
+
+    // Half the cap holds text, the rest the records that point into it
+    struct sort_state st = { &o };
+    struct sort_input in = { 0 };
+    in.cap = o.memory / 2;
+    in.items_max = o.memory / 2 / sizeof(struct sort_item);
+    in.buf = malloc(in.cap);
+    if (!in.buf) ksh_allocate_error();
+
+    int r = 0;
+    if (args[i] == NULL) r = input_read_fd(&st, &in, STDIN_FILENO);
+    for (; args[i] != NULL && r == 0; i ++ )
+    {
+        int fd = open(args[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            fprintf(stderr, "ksh: sort: cannot open \'%s\': %s\n", args[i], strerror(errno));
+            errno = 0;      // reported already
+            r = -1;
+            break;
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        r = input_read_fd(&st, &in, fd);
+        close(fd);
+    }
+
+    if (r == 0)
+    {
+        struct sort_sink sink;
+        fflush(stdout);     // keep the order with earlier printf output
+        if (st.nruns == 0)
+        {
+            // everything fit in memory: straight to the output
+            sink_init(&sink, STDOUT_FILENO, 0);
+            sort_buffer(&o, in.items, in.n, &sink);
+        }
+        else
+        {
+            if (in.n > 0) r = spill(&st, in.items, in.n);
+            free(in.items);
+            free(in.buf);
+            in.items = NULL;
+            in.buf = NULL;
+
+            // too many runs to open at once: merge them in groups first
+            while (r == 0 && st.nruns > SORT_FANIN)
+            {
+                int fd = run_create(&st);
+                if (fd < 0)
+                {
+                    r = -1;
+                    break;
+                }
+                sink_init(&sink, fd, 1);
+                merge_runs(&st, 0, SORT_FANIN, &sink);
+                memmove(st.runs, st.runs + SORT_FANIN, sizeof(int) * (st.nruns - SORT_FANIN));
+                st.nruns -= SORT_FANIN;
+                if ((r = sink_close(&sink)) != 0)
+                {
+                    close(fd);
+                    break;
+                }
+                run_add(&st, fd);
+            }
+            sink_init(&sink, STDOUT_FILENO, 0);
+            if (r == 0)
+            {
+                merge_runs(&st, 0, st.nruns, &sink);
+                st.nruns = 0;
+            }
+        }
+        if (sink_close(&sink) != 0) r = -1;
+    }
+    if (r != 0 && errno) perror("ksh: sort failed...");
+    ksh_last_status = r != 0 ? 2 : 0;
+
+    for (int k = 0; k < st.nruns; k ++ ) close(st.runs[k]);
+    free(st.runs);
+    free(in.items);
+    free(in.buf);
+    return 1;
+}
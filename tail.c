@@ -0,0 +1,500 @@
+#define _GNU_SOURCE
+#include "built-in.h"
+#include "launch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/inotify.h>
+#include <linux/limits.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KSH_HAVE_X86 1
+#endif
+
+// tail [-n N] [-f | -F] [file...]
+//
+// The last N lines of a regular file are found from the end: blocks are
+// read backwards with pread() and searched for newlines with SIMD, so a
+// 20 GB log costs a few blocks, not a full read. Pipes and FIFOs are read
+// through to the end, keeping only a bounded tail in memory, with or
+// without -f.
+//
+// -f follows the files as they grow. Regular files are watched through one
+// inotify descriptor, waited on with poll(), so an idle tail -f sleeps
+// instead of rereading its files. -F follows by name instead and survives log rotation:
+// when the file is renamed or removed, the old file stays open and is still
+// printed as it grows (a logger keeps writing to it until it reopens), and
+// once a new file with that name has data it is followed from its start.
+// Truncation (as done by copytruncate) restarts from the beginning of the
+// file. Ctrl-C stops following and returns to the prompt.
+
+#define TAIL_BLOCK (1 << 20)            // bytes per backward read / copy
+#define TAIL_EVENTS (64 << 10)          // inotify read buffer
+
+// 1. Newline search kernels
+// Each kernel scans p[0..len) from the end and counts newlines down from
+// *need; it returns the index of the newline that brings *need to 0, or
+// SIZE_MAX with *need lowered by the newlines it saw.
+
+// (1) portable fallback
+static size_t tail_scan_scalar(const uint8_t* p, size_t len, long long* need)
+{
+    for (size_t i = len; i -- > 0; )
+        if (p[i] == '\n' && -- *need == 0) return i;
+    return SIZE_MAX;
+}
+
+#ifdef KSH_HAVE_X86
+// (2) SSE2, 16 bytes per step
+__attribute__((target("sse2,popcnt")))
+static size_t tail_scan_sse2(const uint8_t* p, size_t len, long long* need)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = len;
+    while (i >= 16)
+    {
+        i -= 16;
+        unsigned m = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (p + i)), nl));
+        int c = __builtin_popcount(m);
+        if (c < *need)
+        {
+            *need -= c;
+            continue;
+        }
+        // the answer is in this vector: take newlines off the top
+        while (1)
+        {
+            int bit = 31 - __builtin_clz(m);
+            if ( -- *need == 0) return i + bit;
+            m &= ~(1u << bit);
+        }
+    }
+    return tail_scan_scalar(p, i, need);
+}
+
+// (3) AVX2, 32 bytes per step
+__attribute__((target("avx2,popcnt")))
+static size_t tail_scan_avx2(const uint8_t* p, size_t len, long long* need)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = len;
+    while (i >= 32)
+    {
+        i -= 32;
+        uint32_t m = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (p + i)), nl));
+        int c = __builtin_popcount(m);
+        if (c < *need)
+        {
+            *need -= c;
+            continue;
+        }
+        while (1)
+        {
+            int bit = 31 - __builtin_clz(m);
+            if ( -- *need == 0) return i + bit;
+            m &= ~(1u << bit);
+        }
+    }
+    return tail_scan_scalar(p, i, need);
+}
+#endif
+
+static size_t (*tail_kernel)(const uint8_t*, size_t, long long*) = tail_scan_scalar;
+static pthread_once_t tail_once = PTHREAD_ONCE_INIT;
+
+static void tail_dispatch(void)
+{
+#ifdef KSH_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) tail_kernel = tail_scan_avx2;
+    else if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt")) tail_kernel = tail_scan_sse2;
+#endif
+}
+
+// 2. Output, with "==> name <==" headers when there are several files
+struct tail_file {
+    const char* name;
+    int fd;                     // -1 while the file is missing (-F)
+    int regular;                // seekable, followed through inotify
+    off_t off;                  // how far it has been printed
+    dev_t dev;
+    ino_t ino;
+    int wd, dir_wd;             // inotify watches on the file and (-F) its directory
+    char base[NAME_MAX + 1];    // name inside that directory
+    int moved;                  // -F: the name no longer leads to fd, waiting for a new file
+};
+
+struct tail_state {
+    struct tail_file* files;
+    int nfiles;
+    int shown;                  // file whose output came last, for headers
+    int by_name;                // -F
+    char* buf;                  // TAIL_BLOCK bytes
+};
+
+static void tail_write(const void* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(STDOUT_FILENO, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        data = (const char*) data + n;
+        len -= n;
+    }
+}
+
+static void tail_emit(struct tail_state* t, int f, const void* data, size_t len)
+{
+    if (len == 0) return;
+    if (t->nfiles > 1 && t->shown != f)
+    {
+        char header[PATH_MAX + 16];
+        int n = snprintf(header, sizeof(header), "%s==> %s <==\n", t->shown < 0 ? "" : "\n", t->files[f].name);
+        tail_write(header, n < (int) sizeof(header) ? n : (int) sizeof(header) - 1);
+    }
+    t->shown = f;
+    tail_write(data, len);
+}
+
+// 3. The last N lines
+// Start of the last n lines in p[0..len); a final '\n' does not start a line
+static size_t tail_start(const uint8_t* p, size_t len, long long n)
+{
+    long long need = n;
+    if (len > 0 && p[len - 1] == '\n') len -- ;
+    size_t i = tail_kernel(p, len, &need);
+    return i == SIZE_MAX ? 0 : i + 1;
+}
+
+// Regular file: scan backwards block by block from EOF
+static off_t tail_seek_start(int fd, off_t size, long long n, char* buf)
+{
+    long long need = n;
+    off_t end = size;
+    char last;
+    if (end > 0 && pread(fd, &last, 1, end - 1) == 1 && last == '\n') end -- ;
+
+    while (end > 0)
+    {
+        size_t len = end < TAIL_BLOCK ? (size_t) end : TAIL_BLOCK;
+        end -= len;
+        if (pread(fd, buf, len, end) != (ssize_t) len) return -1;
+        size_t i = tail_kernel((const uint8_t*) buf, len, &need);
+        if (i != SIZE_MAX) return end + i + 1;
+    }
+    return 0;
+}
+
+// Print everything from f->off to EOF
+static void tail_drain(struct tail_state* t, int f)
+{
+    struct tail_file* tf = &t->files[f];
+    struct stat st;
+    if (tf->fd < 0) return;
+
+    if (tf->regular && fstat(tf->fd, &st) == 0 && st.st_size < tf->off)
+    {
+        fprintf(stderr, "ksh: tail: %s: file truncated\n", tf->name);
+        tf->off = 0;
+    }
+    while (1)
+    {
+        ssize_t n = tf->regular ? pread(tf->fd, t->buf, TAIL_BLOCK, tf->off) : read(tf->fd, t->buf, TAIL_BLOCK);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        tail_emit(t, f, t->buf, n);
+        tf->off += n;
+    }
+}
+
+// Pipe or terminal: read it all, keeping only the lines that can still matter
+static void tail_stream(struct tail_state* t, int f, long long n)
+{
+    size_t cap = 4 * TAIL_BLOCK, used = 0;
+    char* data = malloc(cap);
+    if (!data) ksh_allocate_error();
+
+    while (1)
+    {
+        if (used == cap && n == 0) used = 0;    // nothing is kept
+        else if (used == cap)
+        {
+            size_t start = tail_start((const uint8_t*) data, used, n);
+            if (start > 0)
+            {
+                memmove(data, data + start, used - start);
+                used -= start;
+            }
+            else
+            {
+                // fewer than n lines fill the buffer: it has to grow
+                cap *= 2;
+                data = realloc(data, cap);
+                if (!data) ksh_allocate_error();
+            }
+        }
+        ssize_t got = read(t->files[f].fd, data + used, cap - used);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        used += got;
+    }
+    size_t start = n > 0 ? tail_start((const uint8_t*) data, used, n) : used;
+    tail_emit(t, f, data + start, used - start);
+    free(data);
+}
+
+static int tail_open(struct tail_state* t, int f)
+{
+    struct tail_file* tf = &t->files[f];
+    struct stat st;
+    tf->fd = strcmp(tf->name, "-") == 0 ? STDIN_FILENO : open(tf->name, O_RDONLY | O_CLOEXEC);
+    if (tf->fd < 0 || fstat(tf->fd, &st) != 0)
+    {
+        if (tf->fd > STDIN_FILENO) close(tf->fd);
+        tf->fd = -1;
+        return -1;
+    }
+    tf->regular = S_ISREG(st.st_mode);
+    tf->dev = st.st_dev;
+    tf->ino = st.st_ino;
+    tf->off = 0;
+    return 0;
+}
+
+// 4. Following
+static volatile sig_atomic_t tail_stop;
+
+static void tail_on_sigint(int sig)
+{
+    tail_stop = 1;
+}
+
+static void tail_watch(struct tail_state* t, int ino, int f)
+{
+    struct tail_file* tf = &t->files[f];
+    uint32_t mask = IN_MODIFY | (t->by_name ? IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF : 0);
+    tf->wd = tf->fd >= 0 && tf->regular ? inotify_add_watch(ino, tf->name, mask) : -1;
+}
+
+// -F: the name may point somewhere else (or nowhere) now. The old file is
+// kept open and drained until a new file under the name has data, so lines
+// a logger writes between the rename and its reopen are not lost.
+static void tail_reopen(struct tail_state* t, int ino, int f)
+{
+    struct tail_file* tf = &t->files[f];
+    struct stat st;
+    int found = stat(tf->name, &st) == 0;
+    int old_fd = tf->fd, old_wd = tf->wd;
+
+    if (old_fd >= 0)
+    {
+        tail_drain(t, f);
+        if (found && st.st_dev == tf->dev && st.st_ino == tf->ino) return;     // still the same file
+        if (!tf->moved) fprintf(stderr, "ksh: tail: \'%s\' has been moved or removed, reading it until a new file appears\n", tf->name);
+        tf->moved = 1;
+        if (!found || !S_ISREG(st.st_mode) || st.st_size == 0) return;
+    }
+
+    if (tail_open(t, f) != 0)
+    {
+        tf->fd = old_fd;
+        return;
+    }
+    if (old_fd >= 0)
+    {
+        // the new file has data: the old one is finished, its watch goes with it
+        if (old_wd >= 0) inotify_rm_watch(ino, old_wd);
+        close(old_fd);
+    }
+    tf->moved = 0;
+    fprintf(stderr, "ksh: tail: \'%s\' has %s; following new file\n", tf->name, old_fd >= 0 ? "been replaced" : "appeared");
+    tail_watch(t, ino, f);
+    tail_drain(t, f);
+}
+
+static void tail_inotify(struct tail_state* t, int ino, char* events)
+{
+    ssize_t len;
+    while ((len = read(ino, events, TAIL_EVENTS)) > 0)
+    {
+        for (char* p = events; p < events + len; )
+        {
+            const struct inotify_event* ev = (const struct inotify_event*) p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            for (int f = 0; f < t->nfiles; f ++ )
+            {
+                struct tail_file* tf = &t->files[f];
+                if (ev->mask & IN_Q_OVERFLOW)
+                {
+                    // events were lost: check everything
+                    if (t->by_name) tail_reopen(t, ino, f);
+                    tail_drain(t, f);
+                }
+                else if (ev->wd == tf->wd && tf->wd >= 0)
+                {
+                    if (ev->mask & IN_IGNORED) tf->wd = -1;
+                    else if (ev->mask & IN_MODIFY) tail_drain(t, f);
+                    else if (t->by_name) tail_reopen(t, ino, f);
+                }
+                // writes under the name matter only while waiting for a new file to fill
+                else if (ev->wd == tf->dir_wd && ev->len && strcmp(ev->name, tf->base) == 0 &&
+                         (!(ev->mask & IN_MODIFY) || tf->moved))
+                    tail_reopen(t, ino, f);
+            }
+        }
+    }
+}
+
+static void tail_follow(struct tail_state* t)
+{
+    int ino = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    char* events = malloc(TAIL_EVENTS);
+    if (!events) ksh_allocate_error();
+    if (ino < 0)
+    {
+        perror("ksh: tail: cannot follow...");
+        free(events);
+        return;
+    }
+
+    // the inotify descriptor carries every regular file; pipes were read to
+    // their end already and have nothing more to follow
+    int active = 0;
+    for (int f = 0; f < t->nfiles; f ++ )
+    {
+        struct tail_file* tf = &t->files[f];
+        tf->wd = tf->dir_wd = -1;
+        if (t->by_name && strcmp(tf->name, "-") != 0)
+        {
+            char copy[PATH_MAX];
+            snprintf(copy, sizeof(copy), "%s", tf->name);
+            snprintf(tf->base, sizeof(tf->base), "%s", basename(copy));
+            snprintf(copy, sizeof(copy), "%s", tf->name);
+            tf->dir_wd = inotify_add_watch(ino, dirname(copy), IN_CREATE | IN_MOVED_TO | IN_ATTRIB | IN_MODIFY);
+            active ++ ;
+        }
+        if (tf->fd < 0 || !tf->regular) continue;
+        tail_watch(t, ino, f);
+        tail_drain(t, f);       // whatever was written before the watch existed
+        active ++ ;
+    }
+
+    // Ctrl-C ends the loop instead of the shell; reset the flag first, so a
+    // Ctrl-C that arrives as soon as the handler is in place is not lost
+    struct sigaction sa, old;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = tail_on_sigint;
+    sigemptyset(&sa.sa_mask);
+    tail_stop = 0;
+    sigaction(SIGINT, &sa, &old);
+
+    struct pollfd pfd = { .fd = ino, .events = POLLIN };
+    while (!tail_stop && active > 0)
+    {
+        int n = poll(&pfd, 1, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+
+        if (n > 0) tail_inotify(t, ino, events);
+    }
+
+    sigaction(SIGINT, &old, NULL);
+    close(ino);
+    free(events);
+}
+
+// 5. tail command
+int ksh_tail(char** args)
+{
+    long long lines = 10;
+    int follow = 0, by_name = 0;
+    int i = 1;
+
+    pthread_once(&tail_once, tail_dispatch);
+
+    // Parse the options: -n N, -nN, -N, -f, -F
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i ++ )
+    {
+        char* a = args[i];
+        if (strcmp(a, "-f") == 0) follow = 1;
+        else if (strcmp(a, "-F") == 0) follow = by_name = 1;
+        else if (a[1] == 'n' || (a[1] >= '0' && a[1] <= '9'))
+        {
+            char* value = a[1] != 'n' ? a + 1 : a[2] ? a + 2 : args[ ++ i];
+            char* end;
+            if (value == NULL || (lines = strtoll(value, &end, 10), *end != '\0') || lines < 0)
+            {
+                fprintf(stderr, "ksh: tail: invalid number of lines\n");
+                ksh_last_status = 1;
+                return 1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Usage: tail [-n N] [-f | -F] [file...]\n");
+            ksh_last_status = 1;
+            return 1;
+        }
+    }
+
+    char* stdin_only[] = { "-", NULL };
+    char** names = (args[i] != NULL) ? &args[i] : stdin_only;
+    struct tail_state t = { 0 };
+    while (names[t.nfiles] != NULL) t.nfiles ++ ;
+    t.files = calloc(t.nfiles, sizeof(struct tail_file));
+    t.buf = malloc(TAIL_BLOCK);
+    if (!t.files || !t.buf) ksh_allocate_error();
+    t.shown = -1;
+    t.by_name = by_name;
+    ksh_last_status = 0;
+    fflush(stdout);     // keep the order with earlier printf output
+
+    for (int f = 0; f < t.nfiles; f ++ )
+    {
+        struct tail_file* tf = &t.files[f];
+        tf->name = names[f];
+        if (tail_open(&t, f) != 0)
+        {
+            fprintf(stderr, "ksh: tail: cannot open \'%s\': %s%s\n", tf->name, strerror(errno), by_name ? ", waiting for it" : "");
+            ksh_last_status = 1;
+            continue;
+        }
+
+        if (tf->regular && lines == 0) tf->off = lseek(tf->fd, 0, SEEK_END);
+        else if (tf->regular)
+        {
+            struct stat st;
+            off_t start = fstat(tf->fd, &st) == 0 ? tail_seek_start(tf->fd, st.st_size, lines, t.buf) : -1;
+            if (start < 0)
+            {
+                fprintf(stderr, "ksh: tail: cannot read \'%s\': %s\n", tf->name, strerror(errno));
+                ksh_last_status = 1;
+                continue;
+            }
+            tf->off = start;
+            tail_drain(&t, f);
+        }
+        // a pipe or FIFO, followed or not, shows its last lines once the writer is done
+        else tail_stream(&t, f, lines);
+    }
+
+    if (follow) tail_follow(&t);
+
+    for (int f = 0; f < t.nfiles; f ++ )
+        if (t.files[f].fd > STDIN_FILENO) close(t.files[f].fd);
+    free(t.files);
+    free(t.buf);
+    return 1;
+}
@@ -0,0 +1,51 @@
+#!/bin/sh
+# Run small ksh scripts and compare their output with what is expected
+#
+# Usage: test/script.sh
+# Run from the repository root after 'make' (or run 'make test'). Prints one line per case and
+# exits 1 if any of them failed.
+
+ROOT=$(pwd)
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/ksh_test.XXXXXX")
+trap 'rm -rf "$TMP"' EXIT
+FAILED=0
+
+# check <name> <expected output>; the script is read from standard input
+# and only its standard output is compared
+check() {
+    cat > "$TMP/case.ksh"
+    (cd "$TMP" && "$ROOT/shell" case.ksh) > "$TMP/out" 2> /dev/null
+    printf '%s\n' "$2" > "$TMP/want"
+    if cmp -s "$TMP/out" "$TMP/want"; then echo "ok    $1"
+    else
+        echo "FAIL  $1"
+        diff "$TMP/want" "$TMP/out" | sed 's/^/      /'
+        FAILED=1
+    fi
+}
+
+mkdir "$TMP/d" && touch "$TMP/d/a"
+
+# ';' separates commands in a script, so the one ending -exec is quoted
+check "find -exec with \\;" "hit d/a " <<'EOF'
+find d -name a -exec echo hit {} \;
+EOF
+check "find -exec with ';'" "hit d/a " <<'EOF'
+find d -name a -exec echo hit {} ';'
+EOF
+check "find -exec with +" "hit d/a " <<'EOF'
+find d -name a -exec echo hit {} +
+EOF
+check "find -exec status" "1 " <<'EOF'
+find d -name a -exec false {} +
+echo $?
+EOF
+
+# a failing built-in sets $? and the script goes on
+check "if on a failing built-in" "no 1 
+still here " <<'EOF'
+if rm missing; then echo yes; else echo no $?; fi
+echo still here
+EOF
+
+exit $FAILED
@@ -0,0 +1,209 @@
+#include "trace.h"
+#include "built-in.h"
+#include "launch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <linux/limits.h>
+
+// Every thread appends to its own ring buffer, so recording an event takes
+// no lock and never contends with other threads; a full ring overwrites its
+// oldest events. Rings are linked into one global list that the dump walks,
+// and a ring whose thread has exited is handed to the next new thread
+// (pool workers come and go with every parallel built-in).
+
+#define KSH_TRACE_RING 16384    // events per thread, a power of two
+#define KSH_TRACE_DETAIL 24     // bytes of detail text kept per event
+
+int ksh_trace_enabled;
+
+struct ksh_trace_event {
+    const char* name;           // stage name, always a string literal
+    uint64_t start, end;        // CLOCK_MONOTONIC nanoseconds
+    char detail[KSH_TRACE_DETAIL];
+};
+
+struct ksh_trace_ring {
+    struct ksh_trace_event ev[KSH_TRACE_RING];
+    uint64_t head;              // events written so far, published with release stores
+    int tid;
+    int in_use;                 // owned by a live thread
+    struct ksh_trace_ring* next;
+};
+
+static struct ksh_trace_ring* rings;        // list head, only ever pushed to
+static __thread struct ksh_trace_ring* my_ring;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static char trace_path[PATH_MAX] = "ksh-trace.json";
+static pid_t trace_pid;                     // forked children must not write the file
+
+uint64_t ksh_trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Thread exit: give the ring back, its events stay for the dump
+static void ring_release(void* p)
+{
+    struct ksh_trace_ring* ring = p;
+    __atomic_store_n(&ring->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void ring_key_create(void)
+{
+    pthread_key_create(&ring_key, ring_release);
+}
+
+static struct ksh_trace_ring* ring_acquire(void)
+{
+    struct ksh_trace_ring* ring;
+    int tid = (int) syscall(SYS_gettid);
+
+    pthread_once(&ring_key_once, ring_key_create);
+
+    // (1) reuse the ring of a thread that has exited
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&ring->in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+    }
+
+    // (2) or push a new one onto the list with compare-and-swap
+    if (ring == NULL)
+    {
+        ring = calloc(1, sizeof(struct ksh_trace_ring));
+        if (!ring) ksh_allocate_error();
+        ring->in_use = 1;
+        ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    ring->tid = tid;
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+void ksh_trace_record(const char* name, uint64_t start, const char* detail)
+{
+    if (my_ring == NULL) my_ring = ring_acquire();
+
+    uint64_t head = my_ring->head;
+    struct ksh_trace_event* e = &my_ring->ev[head & (KSH_TRACE_RING - 1)];
+    e->name = name;
+    e->start = start;
+    e->end = ksh_trace_now();
+    if (detail) snprintf(e->detail, sizeof(e->detail), "%s", detail);
+    else e->detail[0] = '\0';
+    __atomic_store_n(&my_ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Write the detail text as a JSON string body
+static void json_escape(FILE* f, const char* s)
+{
+    for (; *s; s ++ )
+    {
+        if (*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+        else if ((unsigned char) *s < 0x20) fprintf(f, "\\u%04x", *s);
+        else fputc(*s, f);
+    }
+}
+
+int ksh_trace_dump(const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (f == NULL) return -1;
+
+    const char* sep = "";
+    int pid = (int) getpid();
+    fprintf(f, "{\"traceEvents\":[");
+    for (struct ksh_trace_ring* ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t first = head > KSH_TRACE_RING ? head - KSH_TRACE_RING : 0;
+        for (uint64_t i = first; i < head; i ++ )
+        {
+            const struct ksh_trace_event* e = &ring->ev[i & (KSH_TRACE_RING - 1)];
+            // "X" is a complete event: start time and duration, in microseconds
+            fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+                    sep, e->name, e->start / 1000.0, (e->end - e->start) / 1000.0, pid, ring->tid);
+            if (e->detail[0])
+            {
+                fprintf(f, ",\"args\":{\"detail\":\"");
+                json_escape(f, e->detail);
+                fprintf(f, "\"}");
+            }
+            fprintf(f, "}");
+            sep = ",";
+        }
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    return fclose(f);
+}
+
+static void trace_dump_at_exit(void)
+{
+    if (getpid() != trace_pid || rings == NULL) return;
+    if (ksh_trace_dump(trace_path) != 0) perror("ksh: trace: cannot write trace file...");
+}
+
+// KSH_TRACE=file turns tracing on from the start and writes the file on exit
+void ksh_trace_init(void)
+{
+    const char* env = getenv("KSH_TRACE");
+    trace_pid = getpid();
+    atexit(trace_dump_at_exit);
+    if (env && *env)
+    {
+        snprintf(trace_path, sizeof(trace_path), "%s", env);
+        ksh_trace_enabled = 1;
+    }
+}
+
+// trace command
+// trace                show whether tracing is on
+// trace on [file]      start recording (file defaults to $KSH_TRACE or ksh-trace.json)
+// trace off            stop recording and write the file
+// trace dump [file]    write what has been recorded so far
+int ksh_trace(char** args)
+{
+    ksh_last_status = 0;
+    if (args[1] == NULL)
+        printf("trace %s (%s)\n", ksh_trace_enabled ? "on" : "off", trace_path);
+    else if (strcmp(args[1], "on") == 0)
+    {
+        if (args[2] != NULL) snprintf(trace_path, sizeof(trace_path), "%s", args[2]);
+        ksh_trace_enabled = 1;
+    }
+    else if (strcmp(args[1], "off") == 0)
+    {
+        ksh_trace_enabled = 0;
+        if (ksh_trace_dump(trace_path) != 0)
+        {
+            perror("ksh: trace: cannot write trace file...");
+            ksh_last_status = 1;
+        }
+    }
+    else if (strcmp(args[1], "dump") == 0)
+    {
+        if (args[2] != NULL) snprintf(trace_path, sizeof(trace_path), "%s", args[2]);
+        if (ksh_trace_dump(trace_path) != 0)
+        {
+            perror("ksh: trace: cannot write trace file...");
+            ksh_last_status = 1;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Usage: trace [on [file] | off | dump [file]]\n");
+        ksh_last_status = 2;
+    }
+    return 1;
+}
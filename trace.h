@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+// Event tracing of the read / split / dispatch / fork / exec / wait stages,
+// written out as Chrome trace-event JSON (load it in chrome://tracing or Perfetto).
+//
+// Usage around a stage:
+//     KSH_TRACE_BEGIN(t);
+//     ... the stage ...
+//     KSH_TRACE_END(t, "split", detail);
+// When tracing is off each macro is one well-predicted branch on a global flag.
+
+extern int ksh_trace_enabled;
+
+#define KSH_TRACE_BEGIN(var) \
+    uint64_t var = __builtin_expect(ksh_trace_enabled, 0) ? ksh_trace_now() : 0
+#define KSH_TRACE_END(var, name, detail) \
+    do { if (__builtin_expect(ksh_trace_enabled, 0) && (var)) ksh_trace_record((name), (var), (detail)); } while (0)
+
+// Function declarations for tracing
+extern void ksh_trace_init(void);
+extern uint64_t ksh_trace_now(void);
+extern void ksh_trace_record(const char* name, uint64_t start, const char* detail);
+extern int ksh_trace_dump(const char* path);
@@ -0,0 +1,386 @@
+#define _GNU_SOURCE
+#include "trash.h"
+#include "built-in.h"
+#include "launch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <time.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/limits.h>
+
+// Every filesystem gets its own trash directory, .ksh-trash-<uid> at its
+// mount root, so the rename never crosses a device. Where the mount root is
+// not writable, the user's data directory (if on that filesystem) or a
+// shared sticky .ksh-trash/<uid> is used instead; with none of them, rm
+// says so and deletes right away. The trash directories in
+// use are listed in ~/.cache/ksh/trash/dirs (or $KSH_TRASH_DIR/dirs); that
+// list is what lets a reclaimer started by the next shell finish the work
+// of one that was killed or never ran. Only one reclaimer runs at a time,
+// it holds an exclusive flock on reclaim.lock while it works.
+
+#define KSH_TRASH_MAX_DIRS 64
+
+// ioprio_set(2) has no glibc wrapper
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+int ksh_trash_defer;
+
+static char trash_dirs[KSH_TRASH_MAX_DIRS][PATH_MAX];     // registered trash directories
+static dev_t trash_devs[KSH_TRASH_MAX_DIRS];
+static int ntrash_dirs = -1;                              // -1: registry not read yet
+static unsigned int trash_counter;
+
+// 1. Registry of trash directories
+static int trash_state_path(const char* name, char path[PATH_MAX])
+{
+    char dir[PATH_MAX];
+    if (ksh_cache_dir("KSH_TRASH_DIR", "trash", dir) != 0) return -1;
+    return ksh_path(path, "%s/%s", dir, name);
+}
+
+// An entry of the registry is only trusted if it still is one of our own
+// trash directories: a real directory (not a symlink), owned by us and
+// named like one trash_dir_for creates. Anything else is dropped, so the
+// registry can never make the reclaimer empty some other directory.
+static int trash_trusted(const char* dir, struct stat* st)
+{
+    char copy[PATH_MAX], parent[PATH_MAX], uid[32];
+    if (lstat(dir, st) != 0 || !S_ISDIR(st->st_mode) || st->st_uid != getuid()) return 0;
+
+    snprintf(copy, sizeof(copy), "%s", dir);
+    const char* name = basename(copy);
+    if (strncmp(name, ".ksh-trash", 10) == 0 || strcmp(name, "ksh-trash") == 0) return 1;
+
+    // <mount root>/.ksh-trash/<uid>
+    snprintf(uid, sizeof(uid), "%d", (int) getuid());
+    snprintf(parent, sizeof(parent), "%s", dir);
+    return strcmp(name, uid) == 0 && strcmp(basename(dirname(parent)), ".ksh-trash") == 0;
+}
+
+static void trash_load_registry(void)
+{
+    char path[PATH_MAX], line[PATH_MAX];
+    ntrash_dirs = 0;
+    if (trash_state_path("dirs", path) != 0) return;
+
+    FILE* f = fopen(path, "r");
+    if (f == NULL) return;
+    while (ntrash_dirs < KSH_TRASH_MAX_DIRS && fgets(line, sizeof(line), f))
+    {
+        struct stat st;
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0' || !trash_trusted(line, &st)) continue;
+        int seen = 0;
+        for (int i = 0; i < ntrash_dirs; i ++ ) if (strcmp(trash_dirs[i], line) == 0) seen = 1;
+        if (seen) continue;
+        snprintf(trash_dirs[ntrash_dirs], PATH_MAX, "%s", line);
+        trash_devs[ntrash_dirs ++ ] = st.st_dev;
+    }
+    fclose(f);
+}
+
+static void trash_register(const char* dir, dev_t dev)
+{
+    char path[PATH_MAX];
+    if (ntrash_dirs >= KSH_TRASH_MAX_DIRS || trash_state_path("dirs", path) != 0) return;
+
+    // several shells may register at once: append under the lock
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) return;
+    flock(fd, LOCK_EX);
+    dprintf(fd, "%s\n", dir);
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    snprintf(trash_dirs[ntrash_dirs], PATH_MAX, "%s", dir);
+    trash_devs[ntrash_dirs ++ ] = dev;
+}
+
+// 2. Find (or create) the trash directory for the filesystem of dev;
+//    parent is a directory on that filesystem
+// A usable trash directory is ours, private and on the right filesystem
+static int trash_usable(const char* dir, dev_t dev)
+{
+    struct stat st;
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) return -1;
+    if (lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || st.st_dev != dev) return -1;
+    return 0;
+}
+
+static int trash_dir_for(const char* parent, dev_t dev, char out[PATH_MAX])
+{
+    char root[PATH_MAX], up[PATH_MAX];
+    struct stat st;
+
+    if (ntrash_dirs < 0) trash_load_registry();
+    for (int i = 0; i < ntrash_dirs; i ++ )
+    {
+        if (trash_devs[i] != dev) continue;
+        snprintf(out, PATH_MAX, "%s", trash_dirs[i]);
+        return 0;
+    }
+
+    // climb from parent while the device stays the same, to the mount root
+    if (realpath(parent, root) == NULL) return -1;
+    while (strcmp(root, "/") != 0)
+    {
+        snprintf(up, sizeof(up), "%s", root);
+        char* dir = dirname(up);
+        if (stat(dir, &st) != 0 || st.st_dev != dev) break;
+        memmove(root, dir, strlen(dir) + 1);
+    }
+    const char* slash = strcmp(root, "/") == 0 ? "" : "/";
+
+    // (1) <mount root>/.ksh-trash-<uid>
+    int found = ksh_path(out, "%s%s.ksh-trash-%d", root, slash, (int) getuid()) == 0 && trash_usable(out, dev) == 0;
+
+    // (2) the mount root is not writable for us: the user's own data
+    //     directory, if it lives on the same filesystem
+    const char* data = getenv("XDG_DATA_HOME");
+    const char* home = getenv("HOME");
+    if (!found && (data || home) && stat(data ? data : home, &st) == 0 && st.st_dev == dev)
+    {
+        int r = data ? ksh_path(out, "%s/ksh-trash", data) : ksh_path(out, "%s/.local/share/ksh-trash", home);
+        found = r == 0 && ksh_mkdirs(out) == 0 && trash_usable(out, dev) == 0;
+    }
+
+    // (3) <mount root>/.ksh-trash/<uid>, under a shared sticky directory an
+    //     administrator may provide (like /tmp, so users cannot touch each other's)
+    if (!found && ksh_path(out, "%s%s.ksh-trash", root, slash) == 0)
+    {
+        if (mkdir(out, 0777) == 0) chmod(out, 01777);
+        if (lstat(out, &st) == 0 && S_ISDIR(st.st_mode) && (st.st_mode & S_ISVTX) && st.st_dev == dev)
+        {
+            char shared[PATH_MAX];
+            memcpy(shared, out, strlen(out) + 1);
+            found = ksh_path(out, "%s/%d", shared, (int) getuid()) == 0 && trash_usable(out, dev) == 0;
+        }
+    }
+
+    if (!found) return -1;
+    trash_register(out, dev);
+    return 0;
+}
+
+// Move path into the trash, returns 0 on success and -1 if the caller
+// should remove it directly (another filesystem's mount point, no trash
+// directory, or the trash itself lies inside path)
+int ksh_trash_move(const char* path)
+{
+    char copy[PATH_MAX], dir[PATH_MAX], target[PATH_MAX];
+    struct stat st, pst;
+
+    if (lstat(path, &st) != 0 || ksh_path(copy, "%s", path) != 0) return -1;
+    snprintf(dir, sizeof(dir), "%s", dirname(copy));
+    if (stat(dir, &pst) != 0 || pst.st_dev != st.st_dev) return -1;
+    if (trash_dir_for(dir, st.st_dev, target) != 0)
+    {
+        fprintf(stderr, "ksh: rm: no usable trash on the filesystem of \'%s\', removing it now\n", path);
+        return -1;
+    }
+
+    char dest[PATH_MAX];
+    if (ksh_path(dest, "%s/%ld.%d.%u", target, (long) time(NULL), (int) getpid(), trash_counter ++ ) == 0 &&
+        renameat(AT_FDCWD, path, AT_FDCWD, dest) == 0) return 0;
+    // EINVAL: the trash lies inside path, which is then removed directly
+    if (errno != EINVAL) fprintf(stderr, "ksh: rm: cannot move \'%s\' to the trash (%s), removing it now\n", path, strerror(errno));
+    return -1;
+}
+
+// 3. Reclaimer
+// Remove name under dirfd, recursively for directories
+static int remove_at(int dirfd, const char* name)
+{
+    if (unlinkat(dirfd, name, 0) == 0 || errno == ENOENT) return 0;
+    if (errno != EISDIR && errno != EPERM) return -1;
+
+    int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return -1;
+    fchmod(fd, 0700);       // a read-only directory in the trash must still be emptied
+    DIR* d = fdopendir(fd);
+    if (d == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    struct dirent* e;
+    while ((e = readdir(d)) != NULL)
+    {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+        remove_at(fd, e->d_name);
+    }
+    closedir(d);
+    return unlinkat(dirfd, name, AT_REMOVEDIR);
+}
+
+// One sweep over every trash directory; returns the number of entries
+// removed, or with count_only the number still pending
+static int trash_sweep(int count_only)
+{
+    int n = 0;
+    trash_load_registry();
+    for (int i = 0; i < ntrash_dirs; i ++ )
+    {
+        // the directory may have been swapped since the registry was read:
+        // open it without following links and check it is still the same one
+        struct stat st;
+        int fd = open(trash_dirs[i], O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) continue;
+        if (fstat(fd, &st) != 0 || st.st_uid != getuid() || st.st_dev != trash_devs[i])
+        {
+            close(fd);
+            continue;
+        }
+        DIR* d = fdopendir(fd);
+        if (d == NULL)
+        {
+            close(fd);
+            continue;
+        }
+
+        struct dirent* e;
+        while ((e = readdir(d)) != NULL)
+        {
+            if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+            if (count_only || remove_at(dirfd(d), e->d_name) == 0) n ++ ;
+        }
+        closedir(d);
+    }
+    return n;
+}
+
+static void reclaimer_main(void)
+{
+    char path[PATH_MAX];
+    if (trash_state_path("reclaim.lock", path) != 0) return;
+    int lock = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock < 0) return;
+
+    // stay out of the way of the user's work: lowest CPU priority, idle I/O class
+    setpriority(PRIO_PROCESS, 0, 19);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+    while (1)
+    {
+        // another reclaimer holds the lock, it will see our entries
+        if (flock(lock, LOCK_EX | LOCK_NB) != 0) break;
+
+        int removed = 0, n;
+        while ((n = trash_sweep(0)) > 0) removed += n;
+        flock(lock, LOCK_UN);
+
+        // an rm --defer that ran just before the unlock saw the lock held and
+        // started nobody, so look again; stop once a sweep makes no progress
+        if (removed == 0 || trash_sweep(1) == 0) break;
+    }
+    close(lock);
+}
+
+// Start a detached reclaimer; the double fork makes it a child of init, so
+// it outlives the shell and the job reaper never reports it
+void ksh_trash_reclaim(void)
+{
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("ksh: fork failed...");
+        return;
+    }
+    if (pid == 0)
+    {
+        if (fork() != 0) _exit(EXIT_SUCCESS);
+        setsid();
+        int null = open("/dev/null", O_RDWR);
+        if (null >= 0)
+        {
+            dup2(null, STDIN_FILENO);
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+            if (null > STDERR_FILENO) close(null);
+        }
+        reclaimer_main();
+        _exit(EXIT_SUCCESS);
+    }
+    waitpid(pid, NULL, 0);
+}
+
+// Finish what an earlier shell left in the trash
+void ksh_trash_init(void)
+{
+    if (trash_sweep(1) > 0) ksh_trash_reclaim();
+}
+
+// 4. trash command
+// trash [status]   pending entries and bytes in every trash directory
+// trash reclaim    start the background reclaimer now
+static long long pending_bytes;
+
+static int add_usage(const char* path, const struct stat* st, int flag, struct FTW* ftw)
+{
+    if (ftw->level > 0) pending_bytes += (long long) st->st_blocks * 512;
+    return 0;
+}
+
+int ksh_trash(char** args)
+{
+    ksh_last_status = 0;
+    if (args[1] != NULL && strcmp(args[1], "reclaim") == 0)
+    {
+        ksh_trash_reclaim();
+        return 1;
+    }
+    if (args[1] != NULL && strcmp(args[1], "status") != 0)
+    {
+        fprintf(stderr, "Usage: trash [status | reclaim]\n");
+        ksh_last_status = 2;
+        return 1;
+    }
+
+    long long total = 0;
+    trash_load_registry();
+    for (int i = 0; i < ntrash_dirs; i ++ )
+    {
+        int entries = 0;
+        DIR* d = opendir(trash_dirs[i]);
+        if (d == NULL) continue;
+        struct dirent* e;
+        while ((e = readdir(d)) != NULL)
+            if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0) entries ++ ;
+        closedir(d);
+
+        pending_bytes = 0;
+        nftw(trash_dirs[i], add_usage, 64, FTW_PHYS);
+        printf("%-40s %6d entries %16lld bytes\n", trash_dirs[i], entries, pending_bytes);
+        total += pending_bytes;
+    }
+
+    // the reclaimer holds the lock for as long as it works
+    char path[PATH_MAX];
+    int running = 0;
+    if (trash_state_path("reclaim.lock", path) == 0)
+    {
+        int lock = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (lock >= 0)
+        {
+            if (flock(lock, LOCK_EX | LOCK_NB) != 0) running = 1;
+            close(lock);
+        }
+    }
+    printf("pending: %lld bytes, reclaimer %s\n", total, running ? "running" : "idle");
+    return 1;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+// Deferred removal: rm --defer renames its target into a trash directory on
+// the same filesystem, which is one metadata operation however big the tree
+// is, and a low-priority background process deletes the trash afterwards.
+
+extern int ksh_trash_defer;     // set -o rm=defer makes every rm deferred
+
+// Function declarations for the trash
+extern int ksh_trash_move(const char* path);
+extern void ksh_trash_reclaim(void);
+extern void ksh_trash_init(void);
@@ -0,0 +1,282 @@
+#include "built-in.h"
+#include "launch.h"
+#include "pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KSH_HAVE_X86 1
+#endif
+
+// wc [-l] [-w] [-c] [file...]
+//
+// A word starts wherever a non-space byte follows a space byte (space,
+// \t, \n, \v, \f, \r as in the C locale), so lines and words can both be
+// counted from two bit masks per vector: "is newline" and "is space".
+
+#define WC_IO_CHUNK (1 << 20)           // bytes per read()
+#define WC_SPLIT_MIN (64ll << 20)       // files at least this big are split across threads
+#define WC_SPLIT_PIECE (16ll << 20)     // size of each piece handed to a thread
+
+struct wc_counts {
+    long long lines, words, bytes;
+};
+
+static inline int wc_isspace(unsigned char c) { return c == ' ' || (unsigned char) (c - '\t') <= 4; }
+
+// 1. Counting kernels
+// Each kernel counts p[0..len) and takes/returns whether the byte before
+// the range was a space, so ranges can be counted independently.
+
+// (1) portable fallback
+static int wc_count_scalar(const uint8_t* p, size_t len, int prev_space, struct wc_counts* c)
+{
+    for (size_t i = 0; i < len; i ++ )
+    {
+        int space = wc_isspace(p[i]);
+        c->lines += (p[i] == '\n');
+        c->words += (prev_space && !space);
+        prev_space = space;
+    }
+    return prev_space;
+}
+
+#ifdef KSH_HAVE_X86
+// (2) SSE2, 16 bytes per step (part of the x86-64 baseline)
+__attribute__((target("sse2,popcnt")))
+static int wc_count_sse2(const uint8_t* p, size_t len, int prev_space, struct wc_counts* c)
+{
+    const __m128i nl = _mm_set1_epi8('\n'), sp = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t'), four = _mm_set1_epi8(4);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*) (p + i));
+        // '\t'..'\r' is the range where (v - '\t') as unsigned is at most 4
+        __m128i d = _mm_sub_epi8(v, tab);
+        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(_mm_min_epu8(d, four), d));
+        unsigned space = (unsigned) _mm_movemask_epi8(ws);
+        unsigned starts = ~space & ((space << 1) | (unsigned) prev_space) & 0xffff;
+        c->lines += __builtin_popcount((unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+        c->words += __builtin_popcount(starts);
+        prev_space = space >> 15;
+    }
+    return wc_count_scalar(p + i, len - i, prev_space, c);
+}
+
+// (3) AVX2, 32 bytes per step
+__attribute__((target("avx2,popcnt")))
+static int wc_count_avx2(const uint8_t* p, size_t len, int prev_space, struct wc_counts* c)
+{
+    const __m256i nl = _mm256_set1_epi8('\n'), sp = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t'), four = _mm256_set1_epi8(4);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (p + i));
+        __m256i d = _mm256_sub_epi8(v, tab);
+        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(_mm256_min_epu8(d, four), d));
+        uint64_t space = (uint32_t) _mm256_movemask_epi8(ws);
+        uint64_t starts = ~space & ((space << 1) | (uint64_t) prev_space) & 0xffffffffull;
+        c->lines += __builtin_popcount((uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+        c->words += __builtin_popcountll(starts);
+        prev_space = (int) (space >> 31);
+    }
+    return wc_count_scalar(p + i, len - i, prev_space, c);
+}
+#endif
+
+static int (*wc_kernel)(const uint8_t*, size_t, int, struct wc_counts*) = wc_count_scalar;
+static pthread_once_t wc_once = PTHREAD_ONCE_INIT;
+
+static void wc_dispatch(void)
+{
+#ifdef KSH_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) wc_kernel = wc_count_avx2;
+    else if (__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt")) wc_kernel = wc_count_sse2;
+#endif
+}
+
+// 2. Split one big file into pieces counted on the worker pool
+// Files are read, never mapped: a file truncated under a mapping would
+// raise SIGBUS and take the shell down, a short read just ends the count.
+struct wc_split {
+    int fd;
+    long long size;
+    struct wc_counts* pieces;
+    int error;                  // first errno from pread
+};
+
+static void wc_piece_worker(int i, void* arg)
+{
+    struct wc_split* split = arg;
+    long long start = i * WC_SPLIT_PIECE;
+    long long end = split->size - start < WC_SPLIT_PIECE ? split->size : start + WC_SPLIT_PIECE;
+    struct wc_counts* c = &split->pieces[i];
+    char* buf = malloc(WC_IO_CHUNK);
+    if (!buf) ksh_allocate_error();
+
+    // the byte just before the piece decides whether its first byte starts a word
+    char before = ' ';
+    int prev_space = (start == 0 || pread(split->fd, &before, 1, start - 1) != 1) ? 1 : wc_isspace(before);
+    for (long long off = start; off < end; )
+    {
+        ssize_t n = pread(split->fd, buf, end - off < WC_IO_CHUNK ? end - off : WC_IO_CHUNK, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0)
+        {
+            int expected = 0;
+            __atomic_compare_exchange_n(&split->error, &expected, errno, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+        if (n <= 0) break;      // the file shrank while we counted
+        c->bytes += n;
+        prev_space = wc_kernel((const uint8_t*) buf, n, prev_space, c);
+        off += n;
+    }
+    free(buf);
+}
+
+static int wc_count_fd(int fd, int need_content, struct wc_counts* c)
+{
+    struct stat st;
+    memset(c, 0, sizeof(*c));
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        // (1) only the byte count was asked for: the inode already knows it
+        if (!need_content)
+        {
+            c->bytes = st.st_size;
+            return 0;
+        }
+
+        // (2) a big file is counted in parallel pieces, each read with pread()
+        if (st.st_size >= WC_SPLIT_MIN && ksh_pool_threads() > 1)
+        {
+            int npieces = (int) ((st.st_size + WC_SPLIT_PIECE - 1) / WC_SPLIT_PIECE);
+            struct wc_split split = { fd, st.st_size, calloc(npieces, sizeof(struct wc_counts)), 0 };
+            if (!split.pieces) ksh_allocate_error();
+            ksh_parallel_for(npieces, wc_piece_worker, &split);
+            for (int i = 0; i < npieces; i ++ )
+            {
+                c->lines += split.pieces[i].lines;
+                c->words += split.pieces[i].words;
+                c->bytes += split.pieces[i].bytes;
+            }
+            free(split.pieces);
+            errno = split.error;
+            return split.error ? -1 : 0;
+        }
+    }
+
+    // (3) everything else, pipes and terminals too: large reads
+    char* buf = malloc(WC_IO_CHUNK);
+    if (!buf) ksh_allocate_error();
+    int prev_space = 1;
+    ssize_t n;
+    while ((n = read(fd, buf, WC_IO_CHUNK)) > 0)
+    {
+        c->bytes += n;
+        if (need_content) prev_space = wc_kernel((const uint8_t*) buf, n, prev_space, c);
+    }
+    free(buf);
+    return (n < 0) ? -1 : 0;
+}
+
+static int wc_digits(long long v)
+{
+    int d = 1;
+    while (v >= 10) { v /= 10; d ++ ; }
+    return d;
+}
+
+static void wc_print(const struct wc_counts* c, int show_lines, int show_words, int show_bytes, int width, const char* name)
+{
+    const char* sep = "";
+    if (show_lines) { printf("%*lld", width, c->lines); sep = " "; }
+    if (show_words) { printf("%s%*lld", sep, width, c->words); sep = " "; }
+    if (show_bytes) printf("%s%*lld", sep, width, c->bytes);
+    if (name) printf(" %s", name);
+    printf("\n");
+}
+
+// 3. wc command
+int ksh_wc(char** args)
+{
+    int show_lines = 0, show_words = 0, show_bytes = 0;
+    int i = 1;
+
+    pthread_once(&wc_once, wc_dispatch);
+
+    // Parse the options, combined flags like "-lw" are allowed
+    while (args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0')
+    {
+        for (const char* f = args[i] + 1; *f; f ++ )
+        {
+            if (*f == 'l') show_lines = 1;
+            else if (*f == 'w') show_words = 1;
+            else if (*f == 'c') show_bytes = 1;
+            else
+            {
+                fprintf(stderr, "ksh: unknown option \'%s\'...\n", args[i]);
+                ksh_last_status = 1;
+                return 1;
+            }
+        }
+        i ++ ;
+    }
+    if (!show_lines && !show_words && !show_bytes) show_lines = show_words = show_bytes = 1;
+    int need_content = show_lines || show_words;
+
+    char* stdin_only[] = { "-", NULL };
+    char** files = (args[i] != NULL) ? &args[i] : stdin_only;
+    int nfiles = 0;
+    while (files[nfiles] != NULL) nfiles ++ ;
+
+    // Count everything first so the columns can be sized to fit
+    struct wc_counts* counts = calloc(nfiles + 1, sizeof(struct wc_counts));
+    int* failed = calloc(nfiles, sizeof(int));
+    if (!counts || !failed) ksh_allocate_error();
+    struct wc_counts* total = &counts[nfiles];
+    ksh_last_status = 0;
+
+    for (int f = 0; f < nfiles; f ++ )
+    {
+        int fd = (strcmp(files[f], "-") == 0) ? STDIN_FILENO : open(files[f], O_RDONLY);
+        if (fd < 0 || wc_count_fd(fd, need_content, &counts[f]) != 0)
+        {
+            fprintf(stderr, "ksh: wc: %s: %s\n", files[f], strerror(errno));
+            failed[f] = 1;
+            ksh_last_status = 1;
+        }
+        if (fd > STDIN_FILENO) close(fd);
+        total->lines += counts[f].lines;
+        total->words += counts[f].words;
+        total->bytes += counts[f].bytes;
+    }
+
+    int width = 1;
+    if (nfiles > 1 || show_lines + show_words + show_bytes > 1)
+    {
+        long long widest = total->bytes > total->words ? total->bytes : total->words;
+        if (total->lines > widest) widest = total->lines;
+        width = wc_digits(widest);
+    }
+
+    for (int f = 0; f < nfiles; f ++ )
+        if (!failed[f]) wc_print(&counts[f], show_lines, show_words, show_bytes, width, args[i] ? files[f] : NULL);
+    if (nfiles > 1) wc_print(total, show_lines, show_words, show_bytes, width, "total");
+
+    free(counts);
+    free(failed);
+    return 1;
+}